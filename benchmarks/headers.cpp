@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) Alex Nekipelov (alex@nekipelov.net)
+ * License: MIT
+ */
+
+// Throughput of data item header encoding: the previous if-chain appending
+// to a vector against cborEncodeHeader storing into space reserved ahead, as
+// the writer does now.
+
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+#include <endian.h>
+#include <stdint.h>
+
+#include "src/cborprivate.h"
+
+// The encoder as it was before the size-class lookup.
+static void legacyWriteInteger(std::vector<char> &buff, uint64_t value, int type)
+{
+    if( value < 24 )
+    {
+        uint8_t byte = type + value;
+
+        buff.push_back(byte);
+    }
+    else if( value < 256 )
+    {
+        uint8_t bytes[2] = {static_cast<uint8_t>(type + 24), static_cast<uint8_t>(value)};
+
+        buff.insert(buff.end(), bytes, bytes + sizeof(bytes));
+    }
+    else if( value < 65536 )
+    {
+        uint16_t ui16 = htobe16(value);
+        uint8_t bytes[3] = {
+            static_cast<uint8_t>(type + 25),
+            static_cast<uint8_t>(ui16 & 0xff),
+            static_cast<uint8_t>((ui16 & 0xff00) >> 8)
+        };
+
+        buff.insert(buff.end(), bytes, bytes + sizeof(bytes));
+    }
+    else if( value < 4294967296LU )
+    {
+        uint32_t ui32 = htobe32(value);
+        uint8_t bytes[5] = {
+            static_cast<uint8_t>(type + 26),
+            static_cast<uint8_t>(ui32 & 0xff),
+            static_cast<uint8_t>((ui32 & 0xff00) >> 8),
+            static_cast<uint8_t>((ui32 & 0xff0000) >> 16),
+            static_cast<uint8_t>((ui32 & 0xff000000) >> 24)
+        };
+
+        buff.insert(buff.end(), bytes, bytes + sizeof(bytes));
+    }
+    else
+    {
+        uint64_t ui64 = htobe64(value);
+        uint8_t bytes[9] = {
+            static_cast<uint8_t>(type + 27),
+            static_cast<uint8_t>(ui64 & 0xff),
+            static_cast<uint8_t>((ui64 & 0xff00) >> 8),
+            static_cast<uint8_t>((ui64 & 0xff0000) >> 16),
+            static_cast<uint8_t>((ui64 & 0xff000000) >> 24),
+            static_cast<uint8_t>((ui64 & 0xff00000000UL) >> 32),
+            static_cast<uint8_t>((ui64 & 0xff0000000000UL) >> 40),
+            static_cast<uint8_t>((ui64 & 0xff000000000000UL) >> 48),
+            static_cast<uint8_t>((ui64 & 0xff00000000000000UL) >> 56)
+        };
+
+        buff.insert(buff.end(), bytes, bytes + sizeof(bytes));
+    }
+}
+
+// Writes all values through the output buffer of the writer.
+static void tableWriteIntegers(std::vector<char> &buff, const std::vector<uint64_t> &values)
+{
+    CborOutputBuffer< std::vector<char> > out(buff);
+
+    for(size_t i = 0; i < values.size(); ++i)
+        out.commit(cborEncodeHeader(out.reserve(cborMaxHeaderSize), values[i], 0x80));
+}
+
+static void legacyWriteIntegers(std::vector<char> &buff, const std::vector<uint64_t> &values)
+{
+    for(size_t i = 0; i < values.size(); ++i)
+        legacyWriteInteger(buff, values[i], 0x80);
+}
+
+typedef void (*WriteFunction)(std::vector<char> &, const std::vector<uint64_t> &);
+
+// Reports the best of several trials, the machine may be noisy.
+static void run(const char *name, WriteFunction write, const std::vector<uint64_t> &values)
+{
+    const int trials = 5;
+    const int rounds = 40;
+    std::vector<char> buff;
+    double best = 0;
+    size_t bytes = 0;
+
+    for(int trial = 0; trial < trials; ++trial)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        for(int round = 0; round < rounds; ++round)
+        {
+            buff.clear();
+            write(buff, values);
+        }
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        if( trial == 0 || seconds < best )
+            best = seconds;
+
+        bytes = buff.size() * rounds;
+    }
+
+    double headers = static_cast<double>(values.size()) * rounds;
+
+    std::cout << name << ": " << headers / best / 1e6 << " M headers/s, "
+              << bytes / best / (1 << 20) << " MiB/s" << std::endl;
+}
+
+int main()
+{
+    // Mostly short lengths, as in typical documents, with every size class.
+    std::vector<uint64_t> values;
+    uint64_t state = 88172645463325252ULL;
+
+    for(size_t i = 0; i < 1000000; ++i)
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+
+        switch( state % 8 )
+        {
+            case 0: case 1: case 2:
+                values.push_back(state % 24);
+                break;
+            case 3: case 4:
+                values.push_back(state % 256);
+                break;
+            case 5:
+                values.push_back(state % 65536);
+                break;
+            case 6:
+                values.push_back(state % 4294967296ULL);
+                break;
+            default:
+                values.push_back(state);
+                break;
+        }
+    }
+
+    run("if-chain", legacyWriteIntegers, values);
+    run("size-class table", tableWriteIntegers, values);
+    return 0;
+}
@@ -7,5 +7,11 @@
 
 #include "cborreader.h"
 #include "cborwriter.h"
+#include "cborfrozen.h"
+#include "cborstream.h"
+#include "cbordiff.h"
+#include "cboredit.h"
+#include "cborschema.h"
+#include "cborjson.h"
 
 #endif // CBOR
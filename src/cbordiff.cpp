@@ -0,0 +1,263 @@
+/*
+ * Copyright (C) Alex Nekipelov (alex@nekipelov.net)
+ * License: MIT
+ */
+
+#include <algorithm>
+
+#include "cbordiff.h"
+#include "cborwriter.h"
+
+namespace {
+
+enum PatchOperation {
+    SetOperation = 0,
+    RemoveOperation = 1,
+    ResizeOperation = 2
+};
+
+typedef std::vector<CborValue> Operations;
+
+void addOperation(Operations &operations, PatchOperation type, const CborPath &path,
+                  const CborValue &argument)
+{
+    std::vector<CborValue> operation;
+
+    operation.reserve(3);
+    operation.push_back(CborValue(static_cast<uint64_t>(type)));
+    operation.push_back(CborValue(path));
+
+    if( type != RemoveOperation )
+        operation.push_back(argument);
+
+    operations.push_back(CborValue(std::move(operation)));
+}
+
+void diff(const CborValue &from, const CborValue &to, CborPath &path, Operations &operations)
+{
+    const std::vector<CborValue> *fromArray = from.getIf< std::vector<CborValue> >();
+    const std::vector<CborValue> *toArray = to.getIf< std::vector<CborValue> >();
+    const std::map<CborValue, CborValue> *fromMap = from.getIf< std::map<CborValue, CborValue> >();
+    const std::map<CborValue, CborValue> *toMap = to.getIf< std::map<CborValue, CborValue> >();
+
+    // Copies of a value share their storage, an unchanged subtree is
+    // skipped without a look inside. Otherwise different hashes prune the
+    // walk; hashes of containers are computed once and cached.
+    if( (fromArray != 0 && fromArray == toArray) || (fromMap != 0 && fromMap == toMap) )
+        return;
+
+    if( from.hash() == to.hash() && from == to )
+        return;
+
+    if( fromArray != 0 && toArray != 0 )
+    {
+        size_t common = std::min(fromArray->size(), toArray->size());
+        size_t first = operations.size();
+        size_t changed = 0;
+
+        for(size_t i = 0; i < common; ++i)
+        {
+            size_t before = operations.size();
+
+            path.push_back(CborValue(static_cast<uint64_t>(i)));
+            diff((*fromArray)[i], (*toArray)[i], path, operations);
+            path.pop_back();
+
+            if( operations.size() != before )
+                ++changed;
+        }
+
+        // Items moved by an insertion change everywhere, then the whole
+        // array may be smaller. Edits inside a few big items are not, so
+        // the encoded sizes decide.
+        if( changed != 0 && changed > toArray->size() / 2 )
+        {
+            Operations collected(operations.begin() + first, operations.end());
+
+            if( cborWrite(CborValue(std::move(collected))).size() >= cborWrite(to).size() )
+            {
+                operations.resize(first);
+                addOperation(operations, SetOperation, path, to);
+                return;
+            }
+        }
+
+        if( fromArray->size() > toArray->size() )
+            addOperation(operations, ResizeOperation, path, CborValue(static_cast<uint64_t>(common)));
+
+        for(size_t i = common; i < toArray->size(); ++i)
+        {
+            path.push_back(CborValue(static_cast<uint64_t>(i)));
+            addOperation(operations, SetOperation, path, (*toArray)[i]);
+            path.pop_back();
+        }
+
+        return;
+    }
+
+    if( fromMap != 0 && toMap != 0 )
+    {
+        // Both maps are sorted, walk them together.
+        std::map<CborValue, CborValue>::const_iterator fromIt = fromMap->begin();
+        std::map<CborValue, CborValue>::const_iterator toIt = toMap->begin();
+
+        while( fromIt != fromMap->end() || toIt != toMap->end() )
+        {
+            if( toIt == toMap->end() || (fromIt != fromMap->end() && fromIt->first < toIt->first) )
+            {
+                path.push_back(fromIt->first);
+                addOperation(operations, RemoveOperation, path, CborValue());
+                path.pop_back();
+                ++fromIt;
+            }
+            else if( fromIt == fromMap->end() || toIt->first < fromIt->first )
+            {
+                path.push_back(toIt->first);
+                addOperation(operations, SetOperation, path, toIt->second);
+                path.pop_back();
+                ++toIt;
+            }
+            else
+            {
+                path.push_back(toIt->first);
+                diff(fromIt->second, toIt->second, path, operations);
+                path.pop_back();
+                ++fromIt;
+                ++toIt;
+            }
+        }
+
+        return;
+    }
+
+    addOperation(operations, SetOperation, path, to);
+}
+
+// Applies one operation to the item at path[depth...]. The child on the path
+// is taken out of its parent while it changes, so it is not shared and is
+// changed in place.
+bool apply(CborValue &value, const CborPath &path, size_t depth,
+           PatchOperation type, const CborValue &argument)
+{
+    if( depth == path.size() )
+    {
+        if( type == SetOperation )
+        {
+            value = argument;
+            return true;
+        }
+
+        if( type == ResizeOperation && value.isArray() && argument.isPositiveInteger() &&
+            argument.toPositiveInteger() <= value.size() )
+        {
+            value.resize(argument.toPositiveInteger());
+            return true;
+        }
+
+        return false;
+    }
+
+    const CborValue &key = path[depth];
+    bool last = depth + 1 == path.size();
+
+    if( value.isArray() )
+    {
+        if( !key.isPositiveInteger() || key.toPositiveInteger() > value.size() )
+            return false;
+
+        size_t index = key.toPositiveInteger();
+
+        if( index == value.size() )
+        {
+            if( !last || type != SetOperation )
+                return false;
+
+            value.append(argument);
+            return true;
+        }
+
+        CborValue child = value.at(index);
+
+        value.setAt(index, CborValue());
+
+        bool result = apply(child, path, depth + 1, type, argument);
+
+        value.setAt(index, child);
+        return result;
+    }
+
+    if( value.isMap() )
+    {
+        if( last && type == RemoveOperation )
+            return value.removeMember(key);
+
+        const CborValue *member = value.find(key);
+
+        if( member == 0 )
+        {
+            if( !last || type != SetOperation )
+                return false;
+
+            value.setMember(key, argument);
+            return true;
+        }
+
+        CborValue child = *member;
+
+        value.setMember(key, CborValue());
+
+        bool result = apply(child, path, depth + 1, type, argument);
+
+        value.setMember(key, child);
+        return result;
+    }
+
+    return false;
+}
+
+} // namespace
+
+CborValue cborDiff(const CborValue &from, const CborValue &to)
+{
+    Operations operations;
+    CborPath path;
+
+    diff(from, to, path, operations);
+    return CborValue(std::move(operations));
+}
+
+bool cborPatch(CborValue &value, const CborValue &patch)
+{
+    const std::vector<CborValue> *operations = patch.getIf< std::vector<CborValue> >();
+
+    if( operations == 0 )
+        return false;
+
+    CborValue result = value;
+
+    for(size_t i = 0; i < operations->size(); ++i)
+    {
+        const std::vector<CborValue> *operation = (*operations)[i].getIf< std::vector<CborValue> >();
+
+        if( operation == 0 || operation->size() < 2 || !(*operation)[0].isPositiveInteger() )
+            return false;
+
+        uint64_t type = (*operation)[0].toPositiveInteger();
+        const CborPath *path = (*operation)[1].getIf<CborPath>();
+        size_t expectedSize = type == RemoveOperation ? 2 : 3;
+
+        if( type > ResizeOperation || path == 0 || operation->size() != expectedSize )
+            return false;
+
+        if( type == RemoveOperation && path->empty() )
+            return false;
+
+        const CborValue &argument = expectedSize == 3 ? (*operation)[2] : (*operation)[1];
+
+        if( !apply(result, *path, 0, static_cast<PatchOperation>(type), argument) )
+            return false;
+    }
+
+    value = result;
+    return true;
+}
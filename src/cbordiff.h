@@ -0,0 +1,28 @@
+/*
+ * Copyright (C) Alex Nekipelov (alex@nekipelov.net)
+ * License: MIT
+ */
+
+#ifndef CBORDIFF_H
+#define CBORDIFF_H
+
+#include "cborvalue.h"
+
+// Returns a patch which turns from into to. Subtrees which are equal in both
+// values are skipped by their shared storage or hashes, so the work and the
+// size of the patch follow the size of the change. Encode the patch with
+// cborWrite to send it.
+//
+// The patch is an array of operations; a path is an array of map keys and
+// array indexes from the root:
+//   [0, path, value]  sets a map member or an array item, the index may be
+//                     the size of the array; an empty path sets the root
+//   [1, path]         removes a map member
+//   [2, path, size]   cuts the array at path to size items
+CborValue cborDiff(const CborValue &from, const CborValue &to);
+
+// Applies a patch made by cborDiff. Returns false and leaves value unchanged
+// if the patch is malformed or does not fit the value.
+bool cborPatch(CborValue &value, const CborValue &patch);
+
+#endif // CBORDIFF_H
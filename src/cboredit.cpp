@@ -0,0 +1,215 @@
+/*
+ * Copyright (C) Alex Nekipelov (alex@nekipelov.net)
+ * License: MIT
+ */
+
+#include "cboredit.h"
+#include "cborprivate.h"
+#include "cborreader.h"
+#include "cborwriter.h"
+
+namespace {
+
+// Compares an encoded map key with a path key. Strings and integers, the
+// usual keys, are compared in place; other keys are decoded.
+bool keyEquals(const unsigned char *data, size_t length, const CborValue &key)
+{
+    uint8_t kind = cborInitialBytes[data[0]].kind;
+    uint64_t argument = 0;
+    size_t headerSize = cborDecodeHeader(data, length, argument);
+
+    if( const std::string *s = key.getIf<std::string>() )
+    {
+        return kind == CborItemString && argument == s->size() &&
+                memcmp(data + headerSize, s->data(), s->size()) == 0;
+    }
+
+    if( key.isPositiveInteger() )
+        return kind == CborItemUnsigned && argument == key.toPositiveInteger();
+
+    if( key.isNegativeInteger() && key.toNegativeInteger() != 0 )
+        return kind == CborItemNegative && argument == key.toNegativeInteger() - 1;
+
+    CborDecoder decoder;
+    CborValue decoded;
+
+    return decoder.read(reinterpret_cast<const char *>(data), length, decoded) && decoded == key;
+}
+
+size_t skip(const unsigned char *data, size_t size)
+{
+    CborSkipInfo info;
+
+    return cborSkipItem(data, size, info);
+}
+
+// Appends the encodings of the values to the container at path and
+// increments its count.
+bool appendToContainer(std::vector<char> &data, const CborPath &path, CborItemKind kind,
+                       const CborValue *key, const CborValue &value)
+{
+    size_t offset = 0;
+    size_t length = data.size();
+
+    if( path.empty() ? data.empty() : !cborFindItem(data.data(), data.size(), path, offset, length) )
+        return false;
+
+    const unsigned char *ptr = reinterpret_cast<const unsigned char *>(data.data()) + offset;
+    uint64_t count = 0;
+    size_t headerSize = cborDecodeHeader(ptr, length, count);
+
+    if( cborInitialBytes[ptr[0]].kind != kind || headerSize == 0 )
+        return false;
+
+    CborWriter writer;
+    size_t end = offset + length;
+
+    if( end == data.size() )
+    {
+        // The common case: the items are encoded right into the data.
+        if( key != 0 )
+            writer.write(data, *key);
+
+        writer.write(data, value);
+    }
+    else
+    {
+        std::vector<char> encoded;
+
+        if( key != 0 )
+            writer.write(encoded, *key);
+
+        writer.write(encoded, value);
+        data.insert(data.begin() + end, encoded.begin(), encoded.end());
+    }
+
+    char header[cborMaxHeaderSize];
+    size_t newHeaderSize = cborEncodeHeader(header, count + 1, kind == CborItemArray ? 0x80 : 0xa0);
+    std::vector<char>::iterator headerEnd = data.begin() + offset + headerSize;
+
+    // Moves the items only when the count needs another size class, or if
+    // the old header was longer than necessary.
+    if( newHeaderSize > headerSize )
+        data.insert(headerEnd, newHeaderSize - headerSize, 0);
+    else if( newHeaderSize < headerSize )
+        data.erase(headerEnd - (headerSize - newHeaderSize), headerEnd);
+
+    memcpy(data.data() + offset, header, newHeaderSize);
+    return true;
+}
+
+} // namespace
+
+bool cborFindItem(const char *data, size_t size, const CborPath &path,
+                  size_t &offset, size_t &length)
+{
+    const unsigned char *ptr = reinterpret_cast<const unsigned char *>(data);
+    size_t position = 0;
+
+    for(size_t level = 0; level < path.size(); ++level)
+    {
+        if( position >= size )
+            return false;
+
+        uint8_t kind = cborInitialBytes[ptr[position]].kind;
+        uint64_t count = 0;
+        size_t headerSize = cborDecodeHeader(ptr + position, size - position, count);
+
+        if( headerSize == 0 )
+            return false;
+
+        size_t item = position + headerSize;
+        const CborValue &key = path[level];
+
+        if( kind == CborItemArray )
+        {
+            if( !key.isPositiveInteger() || key.toPositiveInteger() >= count )
+                return false;
+
+            for(uint64_t i = 0; i < key.toPositiveInteger(); ++i)
+            {
+                size_t itemLength = skip(ptr + item, size - item);
+
+                if( itemLength == 0 )
+                    return false;
+
+                item += itemLength;
+            }
+
+            position = item;
+        }
+        else if( kind == CborItemMap )
+        {
+            size_t found = 0;
+
+            for(uint64_t i = 0; i < count; ++i)
+            {
+                size_t keyLength = skip(ptr + item, size - item);
+
+                if( keyLength == 0 )
+                    return false;
+
+                if( keyEquals(ptr + item, keyLength, key) )
+                    found = item + keyLength;
+
+                item += keyLength;
+
+                size_t valueLength = skip(ptr + item, size - item);
+
+                if( valueLength == 0 )
+                    return false;
+
+                item += valueLength;
+            }
+
+            if( found == 0 )
+                return false;
+
+            position = found;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    size_t itemLength = position < size ? skip(ptr + position, size - position) : 0;
+
+    if( itemLength == 0 )
+        return false;
+
+    offset = position;
+    length = itemLength;
+    return true;
+}
+
+bool cborReplaceItem(std::vector<char> &data, const CborPath &path, const CborValue &value)
+{
+    size_t offset = 0;
+    size_t length = 0;
+
+    if( !cborFindItem(data.data(), data.size(), path, offset, length) )
+        return false;
+
+    std::vector<char> encoded = cborWrite(value);
+    std::vector<char>::iterator end = data.begin() + offset + length;
+
+    if( encoded.size() > length )
+        data.insert(end, encoded.size() - length, 0);
+    else if( encoded.size() < length )
+        data.erase(end - (length - encoded.size()), end);
+
+    memcpy(data.data() + offset, encoded.data(), encoded.size());
+    return true;
+}
+
+bool cborAppendItem(std::vector<char> &data, const CborPath &path, const CborValue &item)
+{
+    return appendToContainer(data, path, CborItemArray, 0, item);
+}
+
+bool cborAppendMember(std::vector<char> &data, const CborPath &path,
+                      const CborValue &key, const CborValue &value)
+{
+    return appendToContainer(data, path, CborItemMap, &key, value);
+}
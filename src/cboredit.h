@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) Alex Nekipelov (alex@nekipelov.net)
+ * License: MIT
+ */
+
+#ifndef CBOREDIT_H
+#define CBOREDIT_H
+
+#include <vector>
+
+#include "cborvalue.h"
+
+// Editing of encoded data without decoding it. Paths are map keys and array
+// indexes from the root, as for CborDecoder::addRawPath. Only the items on
+// the way to the path are looked at: the items before it in each container
+// are skipped over, the rest of the data is not touched. Map keys are matched
+// by value; with duplicate keys the last one is used, as by the decoder.
+// Tagged items, string references and shared values are not followed.
+
+// Finds the item at path. Returns false if there is no such item or the data
+// on the way to it is malformed.
+bool cborFindItem(const char *data, size_t size, const CborPath &path,
+                  size_t &offset, size_t &length);
+
+// Replaces the item at path with the encoding of value. An encoding of the
+// same size is written over the old one; otherwise the rest of the data is
+// moved once. Container headers hold item counts, not sizes, so they stay
+// as they are. Returns false and leaves data unchanged if there is no item
+// at path.
+bool cborReplaceItem(std::vector<char> &data, const CborPath &path, const CborValue &value);
+
+// Append an item to the array at path, or a key and a value to the map at
+// path. The encoding is copied after the last item and the count in the
+// header is incremented; the header grows by a few bytes only when the count
+// needs a longer argument. For an empty path data must hold just the root
+// container, which is not scanned: appending to it costs only the encoding
+// of the new item. An appended key equal to an existing one replaces its
+// value for the decoder. Return false and leave data unchanged if there is
+// no array or map at path.
+bool cborAppendItem(std::vector<char> &data, const CborPath &path, const CborValue &item);
+bool cborAppendMember(std::vector<char> &data, const CborPath &path,
+                      const CborValue &key, const CborValue &value);
+
+#endif // CBOREDIT_H
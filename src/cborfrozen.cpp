@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) Alex Nekipelov (alex@nekipelov.net)
+ * License: MIT
+ */
+
+#include <unordered_set>
+
+#include "cborfrozen.h"
+
+namespace {
+
+// Copies a value into new storage. Equal strings, byte strings, arrays and
+// maps are stored once; interning a container computes its hash.
+class Freezer
+{
+public:
+    CborValue freeze(const CborValue &value)
+    {
+        if( const std::string *s = value.getIf<std::string>() )
+        {
+            std::unordered_set<CborValue>::const_iterator it = interned.find(value);
+
+            return it != interned.end() ? *it : intern(CborValue(std::string(*s)));
+        }
+        else if( const std::vector<char> *bytes = value.getIf< std::vector<char> >() )
+        {
+            std::unordered_set<CborValue>::const_iterator it = interned.find(value);
+
+            return it != interned.end() ? *it : intern(CborValue(std::vector<char>(*bytes)));
+        }
+        else if( const std::vector<CborValue> *arr = value.getIf< std::vector<CborValue> >() )
+        {
+            std::vector<CborValue> items;
+
+            items.reserve(arr->size());
+
+            for(size_t i = 0; i < arr->size(); ++i)
+                items.push_back(freeze((*arr)[i]));
+
+            return intern(CborValue(std::move(items)));
+        }
+        else if( const std::map<CborValue, CborValue> *map = value.getIf< std::map<CborValue, CborValue> >() )
+        {
+            std::map<CborValue, CborValue> members;
+            std::map<CborValue, CborValue>::const_iterator it = map->begin();
+
+            // The source is sorted already, every insert goes to the end.
+            for(; it != map->end(); ++it)
+                members.emplace_hint(members.end(), freeze(it->first), freeze(it->second));
+
+            return intern(CborValue(std::move(members)));
+        }
+
+        return value;
+    }
+
+private:
+    CborValue intern(const CborValue &value)
+    {
+        return *interned.insert(value).first;
+    }
+
+    std::unordered_set<CborValue> interned;
+};
+
+} // namespace
+
+CborFrozen::CborFrozen(const CborValue &root)
+    : rootValue(root)
+{
+}
+
+CborFrozen::Ptr CborFrozen::freeze(const CborValue &value)
+{
+    Freezer freezer;
+
+    return Ptr(new CborFrozen(freezer.freeze(value)));
+}
+
+const CborValue &CborFrozen::root() const
+{
+    return rootValue;
+}
+
+const CborValue *CborFrozen::find(const CborPath &path) const
+{
+    const CborValue *item = &rootValue;
+
+    for(size_t i = 0; i < path.size() && item != 0; ++i)
+    {
+        if( const std::vector<CborValue> *arr = item->getIf< std::vector<CborValue> >() )
+        {
+            if( path[i].isPositiveInteger() && path[i].toPositiveInteger() < arr->size() )
+                item = &(*arr)[path[i].toPositiveInteger()];
+            else
+                item = 0;
+        }
+        else
+        {
+            item = item->find(path[i]);
+        }
+    }
+
+    return item;
+}
+
+CborSnapshot::CborSnapshot()
+    : currentVersion(0)
+{
+}
+
+CborSnapshot::CborSnapshot(const CborFrozen::Ptr &document)
+    : document(document), currentVersion(1)
+{
+}
+
+void CborSnapshot::publish(const CborFrozen::Ptr &document)
+{
+    // The document is stored before the version is incremented, so a reader
+    // which sees the new version loads the new document or a later one.
+    // The previous version may be destroyed here.
+    CborFrozen::Ptr previous = this->document.exchange(document);
+
+    currentVersion.fetch_add(1, std::memory_order_release);
+}
+
+CborFrozen::Ptr CborSnapshot::load() const
+{
+    return document.load();
+}
+
+uint64_t CborSnapshot::version() const
+{
+    return currentVersion.load(std::memory_order_acquire);
+}
+
+CborSnapshot::Reader::Reader(const CborSnapshot &snapshot)
+    : snapshot(snapshot), documentVersion(0)
+{
+}
+
+const CborFrozen *CborSnapshot::Reader::current()
+{
+    uint64_t version = snapshot.currentVersion.load(std::memory_order_acquire);
+
+    if( version != documentVersion )
+    {
+        // A version published meanwhile is taken on the next call.
+        document = snapshot.load();
+        documentVersion = version;
+    }
+
+    return document.get();
+}
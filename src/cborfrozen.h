@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) Alex Nekipelov (alex@nekipelov.net)
+ * License: MIT
+ */
+
+#ifndef CBORFROZEN_H
+#define CBORFROZEN_H
+
+#include <atomic>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/smart_ptr/atomic_shared_ptr.hpp>
+
+#include "cborvalue.h"
+
+// Immutable document for many reader threads. Freezing copies the value into
+// storage of exact size, merges equal strings and subtrees and computes all
+// hashes ahead, so readers never write to the document. Use the const
+// accessors which return pointers or references (root(), find(), getIf(),
+// arrayItems(), mapItems()) to read it without copies.
+class CborFrozen {
+public:
+    typedef boost::shared_ptr<const CborFrozen> Ptr;
+
+    static Ptr freeze(const CborValue &value);
+
+    const CborValue &root() const;
+
+    // Returns the item at the path (map keys and array indexes from the
+    // root), or null if there is no such item.
+    const CborValue *find(const CborPath &path) const;
+
+private:
+    explicit CborFrozen(const CborValue &root);
+
+    CborFrozen(const CborFrozen &);
+    CborFrozen &operator = (const CborFrozen &);
+
+    const CborValue rootValue;
+};
+
+// Holds the current version of a frozen document. A writer publishes new
+// versions, readers take the current one through a Reader. An old version is
+// released when the last reader moves on from it. No lock is shared by the
+// writer and the readers: the pointer is swapped atomically.
+class CborSnapshot {
+public:
+    CborSnapshot();
+    explicit CborSnapshot(const CborFrozen::Ptr &document);
+
+    void publish(const CborFrozen::Ptr &document);
+
+    // Returns the current version, null if nothing was published yet.
+    CborFrozen::Ptr load() const;
+
+    // Incremented by every publish().
+    uint64_t version() const;
+
+    // Cache of the current version for one thread. While no new version is
+    // published, current() costs one atomic load: no lock and no reference
+    // counting. The reader must not outlive its snapshot.
+    class Reader {
+    public:
+        explicit Reader(const CborSnapshot &snapshot);
+
+        // Null if nothing was published yet. The document stays valid until
+        // the next call.
+        const CborFrozen *current();
+
+    private:
+        const CborSnapshot &snapshot;
+        CborFrozen::Ptr document;
+        uint64_t documentVersion;
+    };
+
+private:
+    CborSnapshot(const CborSnapshot &);
+    CborSnapshot &operator = (const CborSnapshot &);
+
+    boost::atomic_shared_ptr<const CborFrozen> document;
+    std::atomic<uint64_t> currentVersion;
+};
+
+#endif // CBORFROZEN_H
@@ -0,0 +1,679 @@
+/*
+ * Copyright (C) Alex Nekipelov (alex@nekipelov.net)
+ * License: MIT
+ */
+
+#if __cplusplus >= 201703L
+#include <charconv>
+#endif
+
+#include <stdlib.h>
+
+#include "cborjson.h"
+#include "cborprivate.h"
+
+namespace {
+
+typedef CborOutputBuffer<std::string> JsonOutput;
+typedef CborOutputBuffer< std::vector<char> > CborOutput;
+
+enum ByteEncoding {
+    Base64UrlEncoding,
+    Base64Encoding,
+    Base16Encoding
+};
+
+void writeBytes(JsonOutput &out, const unsigned char *data, size_t size, ByteEncoding encoding)
+{
+    static const char base64Url[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+    static const char base64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    static const char hex[] = "0123456789ABCDEF";
+
+    // The size of the text is known, it is written in one place.
+    size_t length = encoding == Base16Encoding ? size * 2 : (size + 2) / 3 * 4;
+    char *text = out.reserve(length + 2);
+    char *p = text;
+
+    *p++ = '"';
+
+    if( encoding == Base16Encoding )
+    {
+        for(size_t i = 0; i < size; ++i)
+        {
+            *p++ = hex[data[i] >> 4];
+            *p++ = hex[data[i] & 0xf];
+        }
+    }
+    else
+    {
+        const char *alphabet = encoding == Base64Encoding ? base64 : base64Url;
+        size_t i = 0;
+
+        for(; i + 3 <= size; i += 3)
+        {
+            uint32_t bits = (data[i] << 16) | (data[i + 1] << 8) | data[i + 2];
+
+            *p++ = alphabet[bits >> 18];
+            *p++ = alphabet[(bits >> 12) & 0x3f];
+            *p++ = alphabet[(bits >> 6) & 0x3f];
+            *p++ = alphabet[bits & 0x3f];
+        }
+
+        if( i < size )
+        {
+            uint32_t bits = data[i] << 16;
+
+            if( i + 1 < size )
+                bits |= data[i + 1] << 8;
+
+            *p++ = alphabet[bits >> 18];
+            *p++ = alphabet[(bits >> 12) & 0x3f];
+
+            if( i + 1 < size )
+                *p++ = alphabet[(bits >> 6) & 0x3f];
+            else if( encoding == Base64Encoding )
+                *p++ = '=';
+
+            // base64url goes without padding.
+            if( encoding == Base64Encoding )
+                *p++ = '=';
+        }
+    }
+
+    *p++ = '"';
+    out.commit(p - text);
+}
+
+void writeUnsigned(JsonOutput &out, uint64_t value)
+{
+    out.commit(cborFormatUnsigned(value, out.reserve(cborMaxNumberSize)));
+}
+
+// Writes -1 - argument.
+void writeNegative(JsonOutput &out, uint64_t argument)
+{
+    if( argument == std::numeric_limits<uint64_t>::max() )
+    {
+        static const char specialValue[] = "-18446744073709551616"; // -0x10000000000000000
+        out.append(specialValue, sizeof(specialValue) - 1);
+    }
+    else
+    {
+        out.put('-');
+        writeUnsigned(out, argument + 1);
+    }
+}
+
+void writeDouble(JsonOutput &out, double value)
+{
+    if( isfinite(value) )
+        out.commit(cborFormatDouble(value, out.reserve(cborMaxNumberSize)));
+    else
+        out.append("null", 4);
+}
+
+class JsonWriter
+{
+public:
+    JsonWriter(const unsigned char *data, size_t size, size_t maxDepth)
+        : data(data), size(size), maxDepth(maxDepth)
+    {}
+
+    // Writes the item at offset. Returns the offset after it, or 0 if it is
+    // malformed.
+    size_t write(JsonOutput &out, size_t offset, size_t depth, ByteEncoding encoding)
+    {
+        if( offset >= size )
+            return 0;
+
+        uint8_t kind = cborInitialBytes[data[offset]].kind;
+        uint64_t argument = 0;
+        size_t headerSize = cborDecodeHeader(data + offset, size - offset, argument);
+        size_t position = offset + headerSize;
+
+        if( headerSize == 0 )
+            return 0;
+
+        switch( kind )
+        {
+            case CborItemUnsigned:
+                writeUnsigned(out, argument);
+                return position;
+            case CborItemNegative:
+                writeNegative(out, argument);
+                return position;
+            case CborItemBytes:
+            case CborItemString:
+                if( argument > size - position )
+                    return 0;
+
+                if( kind == CborItemString )
+                    cborWriteJsonString(out, data + position, argument);
+                else
+                    writeBytes(out, data + position, argument, encoding);
+
+                return position + argument;
+            case CborItemArray:
+                if( depth >= maxDepth )
+                    return 0;
+
+                out.put('[');
+
+                for(uint64_t i = 0; i < argument; ++i)
+                {
+                    if( i != 0 )
+                        out.put(',');
+
+                    position = write(out, position, depth + 1, encoding);
+
+                    if( position == 0 )
+                        return 0;
+                }
+
+                out.put(']');
+                return position;
+            case CborItemMap:
+                if( depth >= maxDepth )
+                    return 0;
+
+                out.put('{');
+
+                for(uint64_t i = 0; i < argument; ++i)
+                {
+                    if( i != 0 )
+                        out.put(',');
+
+                    position = writeKey(out, position, depth + 1);
+                    out.put(':');
+
+                    if( position != 0 )
+                        position = write(out, position, depth + 1, encoding);
+
+                    if( position == 0 )
+                        return 0;
+                }
+
+                out.put('}');
+                return position;
+            case CborItemTag:
+                // References point to items written before, JSON has no
+                // way to say that.
+                if( argument == StringReference || argument == SharedReference || depth >= maxDepth )
+                    return 0;
+
+                if( argument == ExpectedBase64Url )
+                    encoding = Base64UrlEncoding;
+                else if( argument == ExpectedBase64 )
+                    encoding = Base64Encoding;
+                else if( argument == ExpectedBase16 )
+                    encoding = Base16Encoding;
+
+                return write(out, position, depth + 1, encoding);
+            case CborItemFalse:
+                out.append("false", 5);
+                return position;
+            case CborItemTrue:
+                out.append("true", 4);
+                return position;
+            case CborItemNull:
+            case CborItemUndefined:
+            case CborItemSimple:
+                out.append("null", 4);
+                return position;
+            case CborItemHalf:
+                writeDouble(out, cborReadHalf(argument));
+                return position;
+            case CborItemFloat:
+                writeDouble(out, cborReadFloat(argument));
+                return position;
+            case CborItemDouble:
+                writeDouble(out, cborReadDouble(argument));
+                return position;
+            default:
+                return 0;
+        }
+    }
+
+private:
+    size_t writeKey(JsonOutput &out, size_t offset, size_t depth)
+    {
+        if( offset < size && cborInitialBytes[data[offset]].kind == CborItemString )
+            return write(out, offset, depth, Base64UrlEncoding);
+
+        // Other keys are rare, their text is made aside and then quoted.
+        std::string text;
+        size_t position = 0;
+
+        {
+            JsonOutput textOut(text);
+            position = write(textOut, offset, depth, Base64UrlEncoding);
+        }
+
+        cborWriteJsonString(out, reinterpret_cast<const unsigned char *>(text.data()), text.size());
+        return position;
+    }
+
+    const unsigned char *data;
+    size_t size;
+    size_t maxDepth;
+};
+
+class JsonReader
+{
+public:
+    JsonReader(const char *json, size_t size, std::vector<char> &data, size_t maxDepth)
+        : p(reinterpret_cast<const unsigned char *>(json)), end(p + size)
+        , out(data), maxDepth(maxDepth)
+    {}
+
+    bool read()
+    {
+        if( !readValue(0) )
+            return false;
+
+        skipWhitespace();
+        return p == end;
+    }
+
+private:
+    void skipWhitespace()
+    {
+        while( p != end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t') )
+            ++p;
+    }
+
+    void writeHeader(uint64_t value, int type)
+    {
+        out.commit(cborEncodeHeader(out.reserve(cborMaxHeaderSize), value, type));
+    }
+
+    bool readValue(size_t depth)
+    {
+        skipWhitespace();
+
+        if( p == end )
+            return false;
+
+        switch( *p )
+        {
+            case '{':
+                return readContainer(depth, '}', 0xa0);
+            case '[':
+                return readContainer(depth, ']', 0x80);
+            case '"':
+                return readString();
+            case 't':
+                return readLiteral("true", 4, static_cast<char>(0xf5));
+            case 'f':
+                return readLiteral("false", 5, static_cast<char>(0xf4));
+            case 'n':
+                return readLiteral("null", 4, static_cast<char>(0xf6));
+            default:
+                return readNumber();
+        }
+    }
+
+    bool readLiteral(const char *literal, size_t length, char byte)
+    {
+        if( static_cast<size_t>(end - p) < length || memcmp(p, literal, length) != 0 )
+            return false;
+
+        p += length;
+        out.put(byte);
+        return true;
+    }
+
+    // The count of items is known only at the end: a one byte header is
+    // written first and the items are moved if the count needs a longer one.
+    bool readContainer(size_t depth, char close, int type)
+    {
+        if( depth >= maxDepth )
+            return false;
+
+        size_t start = out.size();
+        uint64_t count = 0;
+        bool isMap = type == 0xa0;
+
+        out.put(0);
+        ++p;
+        skipWhitespace();
+
+        if( p != end && *p == close )
+        {
+            ++p;
+        }
+        else
+        {
+            for(;;)
+            {
+                if( isMap )
+                {
+                    skipWhitespace();
+
+                    if( p == end || *p != '"' || !readString() )
+                        return false;
+
+                    skipWhitespace();
+
+                    if( p == end || *p != ':' )
+                        return false;
+
+                    ++p;
+                }
+
+                if( !readValue(depth + 1) )
+                    return false;
+
+                ++count;
+                skipWhitespace();
+
+                if( p == end )
+                    return false;
+
+                if( *p++ == close )
+                    break;
+
+                if( p[-1] != ',' )
+                    return false;
+            }
+        }
+
+        char header[cborMaxHeaderSize];
+        size_t headerSize = cborEncodeHeader(header, count, type);
+
+        if( headerSize > 1 )
+        {
+            size_t extra = headerSize - 1;
+            size_t itemsSize = out.size() - start - 1;
+
+            out.reserve(extra);
+            memmove(out.data() + start + headerSize, out.data() + start + 1, itemsSize);
+            out.commit(extra);
+        }
+
+        memcpy(out.data() + start, header, headerSize);
+        return true;
+    }
+
+    bool readHex(uint32_t &code)
+    {
+        if( end - p < 4 )
+            return false;
+
+        code = 0;
+
+        for(int i = 0; i < 4; ++i)
+        {
+            unsigned char c = *p++;
+
+            if( c >= '0' && c <= '9' )
+                code = code * 16 + (c - '0');
+            else if( (c | 0x20) >= 'a' && (c | 0x20) <= 'f' )
+                code = code * 16 + ((c | 0x20) - 'a' + 10);
+            else
+                return false;
+        }
+
+        return true;
+    }
+
+    // Reads a \u escape after the 'u', a surrogate pair takes two of them.
+    bool readCodePoint()
+    {
+        uint32_t code = 0;
+
+        if( !readHex(code) || (code >= 0xdc00 && code < 0xe000) )
+            return false;
+
+        if( code >= 0xd800 && code < 0xdc00 )
+        {
+            uint32_t low = 0;
+
+            if( end - p < 2 || p[0] != '\\' || p[1] != 'u' )
+                return false;
+
+            p += 2;
+
+            if( !readHex(low) || low < 0xdc00 || low >= 0xe000 )
+                return false;
+
+            code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+        }
+
+        if( code < 0x80 )
+        {
+            scratch += static_cast<char>(code);
+        }
+        else if( code < 0x800 )
+        {
+            scratch += static_cast<char>(0xc0 | (code >> 6));
+            scratch += static_cast<char>(0x80 | (code & 0x3f));
+        }
+        else if( code < 0x10000 )
+        {
+            scratch += static_cast<char>(0xe0 | (code >> 12));
+            scratch += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+            scratch += static_cast<char>(0x80 | (code & 0x3f));
+        }
+        else
+        {
+            scratch += static_cast<char>(0xf0 | (code >> 18));
+            scratch += static_cast<char>(0x80 | ((code >> 12) & 0x3f));
+            scratch += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+            scratch += static_cast<char>(0x80 | (code & 0x3f));
+        }
+
+        return true;
+    }
+
+    bool readString()
+    {
+        ++p;
+
+        size_t run = cborFindJsonSpecial(p, end - p);
+
+        // Most strings have no escapes and are copied at once.
+        if( run < static_cast<size_t>(end - p) && p[run] == '"' )
+        {
+            writeHeader(run, 0x60);
+            out.append(reinterpret_cast<const char *>(p), run);
+            p += run + 1;
+            return true;
+        }
+
+        scratch.assign(reinterpret_cast<const char *>(p), run);
+        p += run;
+
+        for(;;)
+        {
+            if( p == end )
+                return false;
+
+            unsigned char c = *p++;
+
+            if( c == '"' )
+                break;
+
+            // Control characters must be escaped.
+            if( c != '\\' || p == end )
+                return false;
+
+            switch( *p++ )
+            {
+                case '"': scratch += '"'; break;
+                case '\\': scratch += '\\'; break;
+                case '/': scratch += '/'; break;
+                case 'b': scratch += '\b'; break;
+                case 'f': scratch += '\f'; break;
+                case 'n': scratch += '\n'; break;
+                case 'r': scratch += '\r'; break;
+                case 't': scratch += '\t'; break;
+                case 'u':
+                    if( !readCodePoint() )
+                        return false;
+                    break;
+                default:
+                    return false;
+            }
+
+            run = cborFindJsonSpecial(p, end - p);
+            scratch.append(reinterpret_cast<const char *>(p), run);
+            p += run;
+        }
+
+        writeHeader(scratch.size(), 0x60);
+        out.append(scratch.data(), scratch.size());
+        return true;
+    }
+
+    bool readDigits()
+    {
+        const unsigned char *start = p;
+
+        while( p != end && *p >= '0' && *p <= '9' )
+            ++p;
+
+        return p != start;
+    }
+
+    bool readNumber()
+    {
+        const unsigned char *start = p;
+        bool negative = *p == '-';
+
+        if( negative )
+            ++p;
+
+        // No leading zeros.
+        if( p != end && *p == '0' )
+            ++p;
+        else if( !readDigits() )
+            return false;
+
+        const unsigned char *integerEnd = p;
+        bool isInteger = true;
+
+        if( p != end && *p == '.' )
+        {
+            ++p;
+            isInteger = false;
+
+            if( !readDigits() )
+                return false;
+        }
+
+        if( p != end && (*p == 'e' || *p == 'E') )
+        {
+            ++p;
+            isInteger = false;
+
+            if( p != end && (*p == '+' || *p == '-') )
+                ++p;
+
+            if( !readDigits() )
+                return false;
+        }
+
+        if( isInteger )
+        {
+            uint64_t value = 0;
+            const unsigned char *digit = start + negative;
+
+            for(; digit != integerEnd; ++digit)
+            {
+                uint64_t d = *digit - '0';
+
+                if( value > (std::numeric_limits<uint64_t>::max() - d) / 10 )
+                    break;
+
+                value = value * 10 + d;
+            }
+
+            // Integers which do not fit become floats.
+            if( digit == integerEnd )
+            {
+                if( negative && value != 0 )
+                    writeHeader(value - 1, 0x20);
+                else
+                    writeHeader(value, 0x00);
+
+                return true;
+            }
+        }
+
+        const char *text = reinterpret_cast<const char *>(start);
+        double value = 0;
+
+#if defined(__cpp_lib_to_chars)
+        if( std::from_chars(text, reinterpret_cast<const char *>(p), value).ec != std::errc() )
+#endif
+        {
+            // Out of range: strtod gives infinity or zero.
+            scratch.assign(text, reinterpret_cast<const char *>(p));
+            value = strtod(scratch.c_str(), 0);
+        }
+
+        out.commit(cborEncodeDouble(out.reserve(cborMaxHeaderSize), value));
+        return true;
+    }
+
+    const unsigned char *p;
+    const unsigned char *end;
+    CborOutput out;
+    std::string scratch; // unescaped strings
+    size_t maxDepth;
+};
+
+} // namespace
+
+size_t cborToJson(const char *data, size_t size, std::string &json, size_t maxDepth)
+{
+    size_t originalSize = json.size();
+    size_t length = 0;
+
+    {
+        JsonWriter writer(reinterpret_cast<const unsigned char *>(data), size, maxDepth);
+        JsonOutput out(json);
+
+        length = writer.write(out, 0, 0, Base64UrlEncoding);
+    }
+
+    if( length == 0 )
+        json.resize(originalSize);
+
+    return length;
+}
+
+std::string cborToJson(const std::vector<char> &data)
+{
+    std::string json;
+
+    if( cborToJson(data.data(), data.size(), json) != data.size() )
+        json.clear();
+
+    return json;
+}
+
+bool cborFromJson(const char *json, size_t size, std::vector<char> &data, size_t maxDepth)
+{
+    size_t originalSize = data.size();
+    bool result = false;
+
+    {
+        JsonReader reader(json, size, data, maxDepth);
+        result = reader.read();
+    }
+
+    if( !result )
+        data.resize(originalSize);
+
+    return result;
+}
+
+std::vector<char> cborFromJson(const std::string &json)
+{
+    std::vector<char> data;
+
+    cborFromJson(json.data(), json.size(), data);
+    return data;
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) Alex Nekipelov (alex@nekipelov.net)
+ * License: MIT
+ */
+
+#ifndef CBORJSON_H
+#define CBORJSON_H
+
+#include <string>
+#include <vector>
+
+#include "cborreader.h"
+
+// Streaming transcoders between CBOR and JSON. They go from token to token
+// and append to the output through a cursor; no CborValue is built.
+
+// Appends the JSON text of the item at data to json, converted as RFC 8949,
+// section 6.1 suggests:
+//   - integers and finite floats become numbers; floats keep a fraction or
+//     an exponent, so they are read back as floats;
+//   - byte strings become base64url strings without padding, or base64 and
+//     base16 strings inside tags 22 and 23;
+//   - NaN, infinities, undefined and simple values become null;
+//   - map keys which are not strings become strings holding their JSON text;
+//   - other tags are dropped and their items converted, so bignums become
+//     base64url strings and dates their strings or numbers.
+// Text strings are copied as they are, with the characters JSON requires
+// escaped. Returns the size of the item, or 0 if it is malformed, nested
+// deeper than maxDepth or uses string references or value sharing, which
+// have no JSON form; json is unchanged then.
+size_t cborToJson(const char *data, size_t size, std::string &json,
+                  size_t maxDepth = cborDefaultMaxDepth);
+
+// Returns an empty string if the data is not one well-formed item.
+std::string cborToJson(const std::vector<char> &data);
+
+// Appends the CBOR encoding of the JSON value to data. Numbers without a
+// fraction or an exponent become integers when they fit into 64 bits, other
+// numbers floats in the shortest exact precision. Arrays and maps get
+// definite lengths and keep the order of the JSON text. Strings are not
+// checked to be UTF-8. Returns false and leaves data unchanged if the text
+// is not one JSON value or is nested deeper than maxDepth.
+bool cborFromJson(const char *json, size_t size, std::vector<char> &data,
+                  size_t maxDepth = cborDefaultMaxDepth);
+
+// Returns an empty vector if the text is not valid JSON.
+std::vector<char> cborFromJson(const std::string &json);
+
+#endif // CBORJSON_H
@@ -6,6 +6,16 @@
 #ifndef CBORPRIVATE_H
 #define CBORPRIVATE_H
 
+#include <algorithm>
+#include <limits>
+
+#include <math.h>
+#include <string.h>
+#include <endian.h>
+#include <stdint.h>
+
+#include "cborvalue.h"
+
 enum Types {
     UnsignedInt = 0,
     NegativeInt = 1,
@@ -34,7 +44,515 @@ enum {
     PositiveBignum = 2,
     NegativeBignum = 3,
     DecimalFraction = 4,
-    BigFloat = 5
+    BigFloat = 5,
+    ExpectedBase64Url = 21,
+    ExpectedBase64 = 22,
+    ExpectedBase16 = 23,
+    StringReference = 25,
+    Shareable = 28,
+    SharedReference = 29,
+    StringReferenceNamespace = 256
+};
+
+// What an initial byte starts, see cborInitialBytes.
+enum CborItemKind {
+    CborItemUnsigned,
+    CborItemNegative,
+    CborItemBytes,
+    CborItemString,
+    CborItemArray,
+    CborItemMap,
+    CborItemTag,
+    CborItemFalse,
+    CborItemTrue,
+    CborItemNull,
+    CborItemUndefined,
+    CborItemSimple,     // unassigned simple value
+    CborItemHalf,
+    CborItemFloat,
+    CborItemDouble,
+    CborItemIndefinite, // indefinite length or break
+    CborItemReserved    // additional information 28-30
+};
+
+struct CborInitialByte
+{
+    uint8_t kind;
+    uint8_t argumentSize; // bytes of the argument after the initial byte
+    uint8_t immediate;    // the argument itself when argumentSize is 0
+};
+
+// Everything the initial byte of an item tells, indexed by the byte.
+struct CborInitialByteTable
+{
+    constexpr CborInitialByteTable()
+        : entries()
+    {
+        for(int byte = 0; byte < 256; ++byte)
+        {
+            int majorType = byte >> 5;
+            int minorType = byte & 0x1f;
+            CborInitialByte &entry = entries[byte];
+
+            entry.kind = majorType;
+            entry.argumentSize = 0;
+            entry.immediate = 0;
+
+            if( minorType < 24 )
+                entry.immediate = minorType;
+            else if( minorType < 28 )
+                entry.argumentSize = 1 << (minorType - 24);
+            else if( minorType < 31 )
+                entry.kind = CborItemReserved;
+            else
+                entry.kind = CborItemIndefinite;
+
+            if( majorType != Prim || minorType >= 28 )
+                continue;
+
+            switch( minorType )
+            {
+                case FalseValue: entry.kind = CborItemFalse; break;
+                case TrueValue: entry.kind = CborItemTrue; break;
+                case NullValue: entry.kind = CborItemNull; break;
+                case UndefiendValue: entry.kind = CborItemUndefined; break;
+                case HalfPrecisionFloat: entry.kind = CborItemHalf; break;
+                case SinglePrecisionFloat: entry.kind = CborItemFloat; break;
+                case DoublePrecisionFloat: entry.kind = CborItemDouble; break;
+                default: entry.kind = CborItemSimple; break;
+            }
+        }
+    }
+
+    const CborInitialByte &operator[](unsigned char byte) const
+    {
+        return entries[byte];
+    }
+
+    CborInitialByte entries[256];
+};
+
+constexpr CborInitialByteTable cborInitialBytes;
+
+enum { cborMaxHeaderSize = 9 };
+
+// Encodes the header of a data item: the major type, already shifted (e.g.
+// 0x80 for arrays), and the argument in the shortest form. Always stores
+// cborMaxHeaderSize bytes at out and returns how many of them are in use.
+inline size_t cborEncodeHeader(char *out, uint64_t value, int type)
+{
+    // Argument length by the count of significant bytes of the value.
+    static const uint8_t argumentLength[9] = {1, 1, 2, 4, 4, 8, 8, 8, 8};
+
+    size_t significant = (71 - __builtin_clzll(value | 1)) / 8;
+    size_t length = argumentLength[significant];
+    unsigned int info = 24 + __builtin_ctz(length); // 24, 25, 26 or 27
+    bool immediate = value < 24;
+
+    info = immediate ? static_cast<unsigned int>(value) : info;
+    length = immediate ? 0 : length;
+
+    uint64_t bigEndian = htobe64(value << ((64 - 8 * length) & 63));
+
+    out[0] = static_cast<char>(type + info);
+    memcpy(out + 1, &bigEndian, sizeof(bigEndian));
+
+    return 1 + length;
+}
+
+// Encodes a float in the shortest of half, single and double precision
+// which keeps its value; NaN is written as a half. Stores at most
+// cborMaxHeaderSize bytes at out and returns their count.
+inline size_t cborEncodeDouble(char *out, double value)
+{
+    float single = static_cast<float>(value);
+
+    if( single == value )
+    {
+        uint32_t bits;
+
+        memcpy(&bits, &single, sizeof(bits));
+
+        if( (bits & 0x1fff) == 0 )
+        {
+            // IEEE 754 half-precision, code from MessagePack.
+            uint16_t half = (bits >> 16) & 0x8000;
+            int exponent = (bits >> 23) & 0xff;
+            int mantissa = bits & 0x7fffff;
+            bool exact = true;
+
+            if( exponent == 0 && mantissa == 0 )
+                ;
+            else if( exponent >= 113 && exponent <= 142 )
+                half += ((exponent - 112) << 10) + (mantissa >> 13); // normalized
+            else if( exponent >= 103 && exponent < 113 && (mantissa & ((1 << (126 - exponent)) - 1)) == 0 )
+                half += (mantissa + 0x800000) >> (126 - exponent);  // denormalized
+            else if( exponent == 255 && mantissa == 0 )
+                half += 0x7c00; // infinity
+            else
+                exact = false;
+
+            if( exact )
+            {
+                out[0] = static_cast<char>(0xf9);
+                out[1] = static_cast<char>(half >> 8);
+                out[2] = static_cast<char>(half);
+                return 3;
+            }
+        }
+
+        uint32_t bigEndian = htobe32(bits);
+
+        out[0] = static_cast<char>(0xfa);
+        memcpy(out + 1, &bigEndian, sizeof(bigEndian));
+        return 5;
+    }
+
+    if( value != value )
+    {
+        out[0] = static_cast<char>(0xf9);
+        out[1] = static_cast<char>(0x7e);
+        out[2] = 0;
+        return 3;
+    }
+
+    uint64_t bits;
+
+    memcpy(&bits, &value, sizeof(bits));
+    bits = htobe64(bits);
+    out[0] = static_cast<char>(0xfb);
+    memcpy(out + 1, &bits, sizeof(bits));
+    return 9;
+}
+
+// Decodes the argument of the item at data: an integer, a length, a count,
+// a tag number or the bits of a float. Returns the header size or 0 if the
+// data ends too early.
+inline size_t cborDecodeHeader(const unsigned char *data, size_t size, uint64_t &value)
+{
+    const CborInitialByte &entry = cborInitialBytes[data[0]];
+    size_t width = entry.argumentSize;
+
+    if( width == 0 )
+    {
+        value = entry.immediate;
+        return 1;
+    }
+
+    if( size > sizeof(uint64_t) )
+    {
+        // One fixed-width load, the bytes after the argument are shifted out.
+        uint64_t bigEndian;
+
+        memcpy(&bigEndian, data + 1, sizeof(bigEndian));
+        value = be64toh(bigEndian) >> (64 - 8 * width);
+    }
+    else if( size > width )
+    {
+        value = 0;
+
+        for(size_t i = 1; i <= width; ++i)
+            value = (value << 8) | data[i];
+    }
+    else
+    {
+        return 0;
+    }
+
+    return 1 + width;
+}
+
+// Floats from the argument bits of half, single and double precision items.
+inline double cborReadHalf(uint64_t bits)
+{
+    // adapte from code in rfc7049, Appendix D.
+    uint8_t high = static_cast<uint8_t>(bits >> 8);
+    int exponent = (high >> 2) & 0x1f;
+    int mantissa = ((high & 0x3) << 8) | static_cast<uint8_t>(bits);
+
+    double value = 0;
+
+    if (exponent == 0)
+        value = ldexp(mantissa, -24);
+    else if (exponent != 31)
+        value = ldexp(mantissa + 1024, exponent - 25);
+    else
+        value = mantissa == 0 ? std::numeric_limits<double>::infinity() :
+                            std::numeric_limits<double>::quiet_NaN();
+
+    if( high & 0x80 )
+        value = -value;
+
+    return value;
+}
+
+inline double cborReadFloat(uint64_t bits)
+{
+    uint32_t u32 = static_cast<uint32_t>(bits);
+    float value;
+
+    memcpy(&value, &u32, sizeof(value));
+    return value;
+}
+
+inline double cborReadDouble(uint64_t bits)
+{
+    double value;
+
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// Stringref extension (http://cbor.schmorp.de/stringref): a string gets the
+// next index of its namespace only if it is longer than a reference to that
+// index would be. Encoder and decoder must apply the same rule.
+inline bool cborIsStringReferenceCandidate(size_t length, uint64_t index)
+{
+    if( index < 24 )
+        return length >= 3;
+    else if( index < 0x100 )
+        return length >= 4;
+    else if( index < 0x10000 )
+        return length >= 5;
+    else if( index < 0x100000000ull )
+        return length >= 7;
+    else
+        return length >= 11;
+}
+
+// Appends to a vector or a string through a cursor. The buffer is grown
+// ahead in large steps and cut to the written size on destruction, so small
+// writes are plain stores into space which is already there.
+template<typename Buffer>
+class CborOutputBuffer
+{
+public:
+    explicit CborOutputBuffer(Buffer &buff)
+        : buff(buff), used(buff.size())
+    {}
+
+    ~CborOutputBuffer()
+    {
+        buff.resize(used);
+    }
+
+    // Returns space for at least size bytes, size must not be 0.
+    char *reserve(size_t size)
+    {
+        if( buff.size() - used < size )
+        {
+            // Use the capacity first, then grow as push_back() would.
+            size_t needed = used + size;
+
+            if( buff.capacity() >= needed )
+                buff.resize(buff.capacity());
+            else
+                buff.resize(std::max(needed + 64, used * 2));
+        }
+
+        return &buff[used];
+    }
+
+    void commit(size_t size)
+    {
+        used += size;
+    }
+
+    void put(char c)
+    {
+        *reserve(1) = c;
+        ++used;
+    }
+
+    void append(const char *data, size_t size)
+    {
+        if( size != 0 )
+        {
+            memcpy(reserve(size), data, size);
+            used += size;
+        }
+    }
+
+    // The bytes written so far; the pointer is valid until the next write.
+    size_t size() const
+    {
+        return used;
+    }
+
+    char *data()
+    {
+        return &buff[0];
+    }
+
+    // Drops the bytes written after size.
+    void truncate(size_t size)
+    {
+        used = size;
+    }
+
+private:
+    CborOutputBuffer(const CborOutputBuffer &);
+    CborOutputBuffer &operator = (const CborOutputBuffer &);
+
+    Buffer &buff;
+    size_t used;
 };
 
+// Finds the first byte which a JSON string can not hold as it is: a control
+// character, a quote or a backslash. Eight bytes are tested at once with
+// the "has less than" and "has zero byte" bit tricks. A borrow can mark
+// bytes above a match, never below it, so the lowest mark is exact.
+inline size_t cborFindJsonSpecial(const unsigned char *data, size_t size)
+{
+    const uint64_t ones = 0x0101010101010101ull;
+    size_t i = 0;
+
+    for(; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+    {
+        uint64_t word;
+
+        memcpy(&word, data + i, sizeof(word));
+        word = le64toh(word);
+
+        uint64_t quote = word ^ (ones * '"');
+        uint64_t backslash = word ^ (ones * '\\');
+        uint64_t mask = ((word - ones * 0x20) | (quote - ones) | (backslash - ones)) &
+                        ~word & (ones * 0x80);
+
+        if( mask != 0 )
+            return i + __builtin_ctzll(mask) / 8;
+    }
+
+    for(; i < size; ++i)
+    {
+        if( data[i] < 0x20 || data[i] == '"' || data[i] == '\\' )
+            break;
+    }
+
+    return i;
+}
+
+// Writes a string in quotes with the escapes of JSON, which diagnostic
+// notation shares. The bytes are not checked to be UTF-8.
+template<typename Buffer>
+void cborWriteJsonString(CborOutputBuffer<Buffer> &out, const unsigned char *data, size_t size)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    out.put('"');
+
+    while( size != 0 )
+    {
+        // Runs without special bytes are copied at once.
+        size_t run = cborFindJsonSpecial(data, size);
+
+        out.append(reinterpret_cast<const char *>(data), run);
+
+        if( run == size )
+            break;
+
+        unsigned char c = data[run];
+        char *escape = out.reserve(6);
+
+        escape[0] = '\\';
+
+        switch( c )
+        {
+            case '"': escape[1] = '"'; out.commit(2); break;
+            case '\\': escape[1] = '\\'; out.commit(2); break;
+            case '\b': escape[1] = 'b'; out.commit(2); break;
+            case '\f': escape[1] = 'f'; out.commit(2); break;
+            case '\n': escape[1] = 'n'; out.commit(2); break;
+            case '\r': escape[1] = 'r'; out.commit(2); break;
+            case '\t': escape[1] = 't'; out.commit(2); break;
+            default:
+                memcpy(escape + 1, "u00", 3);
+                escape[4] = hex[c >> 4];
+                escape[5] = hex[c & 0xf];
+                out.commit(6);
+                break;
+        }
+
+        data += run + 1;
+        size -= run + 1;
+    }
+
+    out.put('"');
+}
+
+enum { cborMaxNumberSize = 32 };
+
+// Decimal text of an integer, and the shortest text of a finite double
+// which reads back to the same value. A double always gets a fraction or an
+// exponent, so 1.0 stays a float for the reader of the text. Write at most
+// cborMaxNumberSize bytes and return the count.
+size_t cborFormatUnsigned(uint64_t value, char *out);
+size_t cborFormatDouble(double value, char *out);
+
+// Heap bytes of the storage of strings, vectors and map nodes, as
+// CborValue::memoryUsage() and the decode statistics count them. A string
+// short enough for the inline buffer takes nothing; a map node holds the
+// member and the color and three links of the tree.
+inline size_t cborHeapSize(const std::string &string)
+{
+    static const size_t inlineCapacity = std::string().capacity();
+
+    return string.capacity() > inlineCapacity ? string.capacity() + 1 : 0;
+}
+
+template<typename T>
+inline size_t cborHeapSize(const std::vector<T> &vector)
+{
+    return vector.capacity() * sizeof(T);
+}
+
+static const size_t cborMapNodeSize = sizeof(std::pair<const CborValue, CborValue>) + 4 * sizeof(void *);
+
+// The empty array and map which the decoder puts into all its results.
+// CborValue::memoryUsage() does not count them, as the statistics do not.
+const CborValue &cborSharedEmptyArray();
+const CborValue &cborSharedEmptyMap();
+
+struct CborSkipInfo
+{
+    bool truncated;  // the data ends before the item, it may be complete later
+    bool hasSharing; // the item contains tags 28 or 29
+};
+
+// Where a scan of a truncated item stopped: the first item it did not skip,
+// relative to the start of the data.
+struct CborSkipState
+{
+    CborSkipState() : pending(1), offset(0), hasSharing(false) {}
+
+    uint64_t pending;
+    size_t offset;
+    bool hasSharing;
+};
+
+// Finds the end of the item at data without decoding it. Returns its size or
+// 0 if the item is malformed or truncated, see info.
+size_t cborSkipItem(const unsigned char *data, size_t size, CborSkipInfo &info);
+
+// The same, but the scan starts from state and leaves it where a truncated
+// item stopped, so a growing buffer is scanned only once. The data before
+// state.offset must not change between the calls.
+size_t cborSkipItem(const unsigned char *data, size_t size, CborSkipInfo &info,
+                    CborSkipState &state);
+
+enum { cborMaxDateTimeSize = 36 };
+
+// RFC 3339 date/time of tag 0. The parser accepts only the full format,
+// YYYY-MM-DDTHH:MM:SS[.fraction](Z|+HH:MM|-HH:MM); fraction digits beyond
+// nanoseconds are dropped and the result is a valid date/time, see
+// cborIsValidDateTime. The formatter takes a valid date/time, writes the
+// fraction without trailing zeros in at most cborMaxDateTimeSize bytes and
+// returns the count.
+bool cborParseDateTime(const char *text, size_t size, CborValue::DateTime &result);
+size_t cborFormatDateTime(const CborValue::DateTime &dateTime, char *out);
+
+// True if the local time of dateTime has an RFC 3339 form, as
+// CborValue::DateTime describes.
+bool cborIsValidDateTime(const CborValue::DateTime &dateTime);
+
 #endif // CBORPRIVATE_H
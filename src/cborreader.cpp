@@ -5,467 +5,1352 @@
 
 // See http://tools.ietf.org/search/rfc7049
 
+#include <algorithm>
+#include <functional>
 #include <limits>
+#include <thread>
 
 #include <math.h>
 #include <string.h>
+#include <endian.h>
 #include <stdint.h>
 #include <iostream>
 
 #include "cborprivate.h"
 #include "cborreader.h"
 
-static std::pair<size_t, CborValue> internalRead(const unsigned char *s, size_t size);
+static inline size_t readArgument(const unsigned char *data, size_t size, uint64_t &value)
+{
+    size_t headerSize = cborDecodeHeader(data, size, value);
+
+    if( headerSize == 0 )
+        std::cerr << "Unexpected end of data" << std::endl;
 
-std::pair<size_t, uint64_t> readIntegerValue(unsigned char minorType, const unsigned char *data, size_t size)
+    return headerSize;
+}
+
+// Reports an initial byte that the decoder does not handle.
+static void reportUnsupported(unsigned char initialByte)
 {
-    uint64_t result = 0;
-    size_t bytesCount = 0;
-    
-    enum sizeInBytes {
-        Inline     = 0x17,
-        OneByte    = 0x18,
-        TwoBytes   = 0x19,
-        FourBytes  = 0x1a,
-        EightBytes = 0x1b        
-    };
+    unsigned char majorType = initialByte >> 5;
+    unsigned char minorType = initialByte & 0x1f;
+
+    if( majorType == Prim )
+        std::cerr << "Unsupported simple value " << static_cast<int>(minorType) << std::endl;
+    else if( cborInitialBytes[initialByte].kind == CborItemReserved )
+        std::cerr << "Reserved additional information " << static_cast<int>(minorType) << std::endl;
+    else if( majorType == Bytes || majorType == Utf8String )
+        std::cerr << "Indefinite-length strings are not supported" << std::endl;
+    else if( majorType == Array || majorType == Map )
+        std::cerr << "Indefinite-length containers are not supported" << std::endl;
+    else
+        std::cerr << "Unexpected indefinite-length item" << std::endl;
+}
 
-    switch(minorType)
+static void readNegativeInteger(uint64_t argument, CborValue &result)
+{
+    if( argument == 0xffffffffffffffff )
     {
-        case OneByte: {
-            // one byte uint8_t follows
-            if( size < 2 )
-            {
-                std::cerr << "Unexpected end of data" << std::endl;
-                return std::make_pair(0, 0);
-            }
-            bytesCount = 2;
-            result = data[1];
-            break;
-        }
-        case TwoBytes: {
-            // two byte uint16_t follows
-            if( size < 3 )
-            {
-                std::cerr << "Unexpected end of data" << std::endl;
-                return std::make_pair(0, 0);
-            }
+        // 18446744073709551617
+        const char bigNumData [] = "\x01\x00\x00\x00\x00\x00\x00\x00\x00";
+        CborValue::BigInteger bigInteger;
 
-            uint16_t value = *reinterpret_cast<const uint16_t *>(&data[1]);
-            value = be16toh(value);
-            result = value;
-            bytesCount = 3;
-            break;
-        }
-        case FourBytes: {
-            // four byte uint32_t follows
-            if( size < 5 )
+        bigInteger.positive = false;
+        bigInteger.bigint.assign(bigNumData, bigNumData + sizeof(bigNumData) - 1);
+
+        result = CborValue(bigInteger);
+    }
+    else
+    {
+        result = CborValue(argument + 1, false);
+    }
+}
+
+// Reads the length header of a definite-length string and checks that the
+// payload fits into the buffer. Returns the header size or 0 on error.
+static size_t readStringHeader(const unsigned char *data, size_t size, size_t &length)
+{
+    uint64_t argument = 0;
+    size_t headerSize = readArgument(data, size, argument);
+
+    if( headerSize == 0 )
+        return 0;
+
+    if( argument > size - headerSize )
+    {
+        std::cerr << "Unexpected end of data" << std::endl;
+        return 0;
+    }
+
+    length = argument;
+    return headerSize;
+}
+
+static size_t readBignum(const unsigned char *data, size_t size, bool positive,
+                         CborValue &result)
+{
+    if( size == 0 || cborInitialBytes[data[0]].kind != CborItemBytes )
+    {
+        std::cerr << "Bignum content must be a byte string" << std::endl;
+        return 0;
+    }
+
+    size_t length = 0;
+    size_t headerSize = readStringHeader(data, size, length);
+
+    if( headerSize == 0 )
+        return 0;
+
+    CborValue::BigInteger bigInteger;
+    const char *ptr = reinterpret_cast<const char *>(data + headerSize);
+
+    bigInteger.positive = positive;
+    bigInteger.bigint.assign(ptr, ptr + length);
+
+    if( !positive )
+    {
+        size_t i = bigInteger.bigint.size();
+
+        for(; i != 0 ; --i)
+        {
+            unsigned char c = static_cast<unsigned char>(bigInteger.bigint[i - 1]);
+            if( c == 0xff )
             {
-                std::cerr << "Unexpected end of data" << std::endl;
-                return std::make_pair(0, 0);
+                bigInteger.bigint[i - 1] = 0;
             }
-
-            uint32_t value = *reinterpret_cast<const uint32_t *>(&data[1]);
-            value = be32toh(value);
-            result = value;
-            bytesCount = 5;
-            break;
-        }
-        case EightBytes: {
-            // eight byte uint64_t follows
-            if( size < 9 )
+            else
             {
-                std::cerr << "Unexpected end of data" << std::endl;
-                return std::make_pair(0, 0);
+                bigInteger.bigint[i - 1] = c + 1u;
+                break;
             }
-
-            uint64_t value = *reinterpret_cast<const uint64_t *>(&data[1]);
-            value = be64toh(value);
-            result = value;
-            bytesCount = 9;
-            break;
         }
 
-        default:
-            if( minorType <= Inline )
-            {
-                result = static_cast<uint32_t>(minorType);
-                bytesCount = 1;
-            }
+        if( i == 0 )
+        {
+            // All bytes carried over: the magnitude is 1 followed by zeros.
+            bigInteger.bigint.resize(bigInteger.bigint.size() + 1);
+            bigInteger.bigint[0] = 1;
+        }
     }
 
-    return std::make_pair(bytesCount, result);
+    result = CborValue(bigInteger);
+    return headerSize + length;
 }
 
-std::pair<size_t, CborValue> readPositiveInteger(unsigned char minorType, const unsigned char *data, size_t size)
+// Reads an integer item which fits into int64_t. Returns its size or 0.
+static size_t readInt64(const unsigned char *data, size_t size, int64_t &result)
 {
+    uint8_t kind = size == 0 ? static_cast<uint8_t>(CborItemReserved) : cborInitialBytes[data[0]].kind;
+    uint64_t argument = 0;
+
+    if( kind != CborItemUnsigned && kind != CborItemNegative )
+        return 0;
 
-    return readIntegerValue(minorType, data, size);
+    size_t length = readArgument(data, size, argument);
+
+    if( length == 0 || argument > static_cast<uint64_t>(std::numeric_limits<int64_t>::max()) )
+        return 0;
+
+    result = kind == CborItemUnsigned ? static_cast<int64_t>(argument) : -1 - static_cast<int64_t>(argument);
+    return length;
 }
 
-std::pair<size_t, CborValue> readNegativeInteger(unsigned char minorType, const unsigned char *data, size_t size)
+static size_t readDateTime(const unsigned char *data, size_t size, CborValue &result)
 {
-    std::pair<size_t, uint64_t> pair = readIntegerValue(minorType, data, size);
+    size_t length = 0;
+    size_t headerSize = 0;
+
+    if( size != 0 && cborInitialBytes[data[0]].kind == CborItemString )
+        headerSize = readStringHeader(data, size, length);
 
-    if( pair.first != 0 )
+    CborValue::DateTime dateTime;
+
+    if( headerSize == 0 ||
+        cborParseDateTime(reinterpret_cast<const char *>(data + headerSize), length, dateTime) == false )
     {
-        uint64_t value = pair.second;
-        if( value == 0xffffffffffffffff )
-        {
-            // 18446744073709551617
-            const char bigNumData [] = "\x01\x00\x00\x00\x00\x00\x00\x00\x00";
-            CborValue::BigInteger bigInteger;
+        std::cerr << "Invalid date/time" << std::endl;
+        return 0;
+    }
 
-            bigInteger.positive = false;
-            bigInteger.bigint.assign(bigNumData, bigNumData + sizeof(bigNumData) - 1);
+    result = CborValue(dateTime);
+    return headerSize + length;
+}
 
-            return std::make_pair(pair.first, CborValue(bigInteger));
+static size_t readEpochTime(const unsigned char *data, size_t size, CborValue &result)
+{
+    CborValue::EpochTime epochTime = {true, 0, 0};
+    uint8_t kind = size == 0 ? static_cast<uint8_t>(CborItemReserved) : cborInitialBytes[data[0]].kind;
+    size_t length = 0;
 
-        }
+    if( kind == CborItemUnsigned || kind == CborItemNegative )
+    {
+        length = readInt64(data, size, epochTime.seconds);
+    }
+    else if( kind == CborItemHalf || kind == CborItemFloat || kind == CborItemDouble )
+    {
+        uint64_t bits = 0;
+
+        length = readArgument(data, size, bits);
+        epochTime.integral = false;
+
+        if( kind == CborItemHalf )
+            epochTime.realSeconds = cborReadHalf(bits);
+        else if( kind == CborItemFloat )
+            epochTime.realSeconds = cborReadFloat(bits);
         else
-        {
-            return std::make_pair(pair.first, CborValue(value + 1, false));
-        }
+            epochTime.realSeconds = cborReadDouble(bits);
     }
-    else
+
+    if( length == 0 )
     {
-        return pair;
+        std::cerr << "Invalid epoch time" << std::endl;
+        return 0;
     }
 
+    result = CborValue(epochTime);
+    return length;
 }
 
-std::pair<size_t, CborValue> simpleOrFloat(unsigned char minorType, const unsigned char *data, size_t size)
+// Tags 4 and 5: [exponent, mantissa].
+template<typename T>
+static size_t readExponentMantissa(const unsigned char *data, size_t size, CborValue &result)
 {
-    switch (minorType) {
-        case FalseValue:
-            return std::make_pair(1, CborValue(false));
+    const unsigned char arrayOfTwo = 0x82;
+    T value;
+
+    if( size == 0 || data[0] != arrayOfTwo )
+    {
+        std::cerr << "Exponent and mantissa must be an array of two items" << std::endl;
+        return 0;
+    }
+
+    size_t exponentLength = readInt64(data + 1, size - 1, value.exponent);
+    size_t mantissaLength = 0;
+
+    if( exponentLength != 0 )
+        mantissaLength = readInt64(data + 1 + exponentLength, size - 1 - exponentLength, value.mantissa);
+
+    if( mantissaLength == 0 )
+    {
+        std::cerr << "Unsupported exponent or mantissa" << std::endl;
+        return 0;
+    }
+
+    result = CborValue(value);
+    return 1 + exponentLength + mantissaLength;
+}
+
+static size_t readTagger(const unsigned char *data, size_t size, CborValue &result)
+{
+    uint64_t tag = 0;
+    size_t headerSize = readArgument(data, size, tag);
+
+    if( headerSize == 0 )
+        return 0;
+
+    const unsigned char *content = data + headerSize;
+    size_t contentSize = size - headerSize;
+    size_t contentLength = 0;
+
+    switch(tag)
+    {
+        case TextBasedDateTime:
+            contentLength = readDateTime(content, contentSize, result);
             break;
-        case TrueValue:
-            return std::make_pair(1, CborValue(true));
+        case EpochBasedDateTime:
+            contentLength = readEpochTime(content, contentSize, result);
             break;
-        case NullValue:
-            return std::make_pair(1, CborValue(CborValue::NullTag()));
+        case DecimalFraction:
+            contentLength = readExponentMantissa<CborValue::DecimalFraction>(content, contentSize, result);
             break;
-        case UndefiendValue:
-            return std::make_pair(1, CborValue(CborValue::UndefinedTag()));
+        case BigFloat:
+            contentLength = readExponentMantissa<CborValue::BigFloat>(content, contentSize, result);
             break;
-        case SimpleValue1Byte:
-            // TODO
-            abort();
+        case PositiveBignum:
+            contentLength = readBignum(content, contentSize, true, result);
             break;
-        case HalfPrecisionFloat: {
-            if( size < 3 )
-            {
-                std::cerr << "Unexpected end of data" << std::endl;
-                return std::make_pair(0, CborValue());
-            }
+        case NegativeBignum:
+            contentLength = readBignum(content, contentSize, false, result);
+            break;
+        default:
+            std::cerr << "Unsupported tag " << tag << std::endl;
+            return 0;
+    }
 
-            // adapte from code in rfc7049, Appendix D.
-            uint8_t high = static_cast<uint8_t>(data[1]);
-            int exponent = (high >> 2) & 0x1f;
-            int mantissa = ((high & 0x3) << 8) | static_cast<uint8_t>(data[2]);
+    return contentLength == 0 ? 0 : headerSize + contentLength;
+}
 
-            double value = 0;
+size_t cborSkipItem(const unsigned char *ptr, size_t size, CborSkipInfo &info)
+{
+    CborSkipState state;
 
-            if (exponent == 0)
-                value = ldexp(mantissa, -24);
-            else if (exponent != 31)
-                value = ldexp(mantissa + 1024, exponent - 25);
-            else
-                value = mantissa == 0 ? std::numeric_limits<double>::infinity() :
-                                    std::numeric_limits<double>::quiet_NaN();
+    return cborSkipItem(ptr, size, info, state);
+}
+
+size_t cborSkipItem(const unsigned char *ptr, size_t size, CborSkipInfo &info,
+                    CborSkipState &state)
+{
+    // Items still to skip. Each of them takes at least one byte, so the count
+    // is bounded by the size of the data and can not overflow.
+    uint64_t pending = state.pending;
+    size_t offset = state.offset;
+
+    info.truncated = true;
+    info.hasSharing = state.hasSharing;
 
-            if( high & 0x80 )
-                value = -value;
+    while( pending != 0 )
+    {
+        // A truncated scan resumes from the last item boundary.
+        state.pending = pending;
+        state.offset = offset;
+        state.hasSharing = info.hasSharing;
 
-            return std::make_pair(3, CborValue(value));
+        if( offset >= size )
+            return 0;
+
+        size_t available = size - offset;
+        uint8_t kind = cborInitialBytes[ptr[offset]].kind;
+        uint64_t argument = 0;
+
+        if( kind == CborItemIndefinite || kind == CborItemReserved )
+        {
+            info.truncated = false;
+            return 0;
+        }
+
+        size_t headerSize = cborDecodeHeader(ptr + offset, available, argument);
+
+        if( headerSize == 0 )
+            return 0;
+
+        offset += headerSize;
+        available -= headerSize;
+        --pending;
+
+        switch(kind)
+        {
+            case CborItemBytes:
+            case CborItemString:
+                if( argument > available )
+                    return 0;
+                offset += argument;
+                break;
+            case CborItemArray:
+                if( argument > available )
+                    return 0;
+                pending += argument;
+                break;
+            case CborItemMap:
+                if( argument > available / 2 )
+                    return 0;
+                pending += argument * 2;
+                break;
+            case CborItemTag:
+                info.hasSharing = info.hasSharing || argument == Shareable || argument == SharedReference;
+                ++pending;
+                break;
         }
-        case SinglePrecisionFloat: {
-            if( size < 5 )
-            {
-                std::cerr << "Unexpected end of data" << std::endl;
-                return std::make_pair(0, CborValue());
-            }
 
-            union {
-                uint32_t u32;
-                float value;
-            } buf;
+        if( pending > size - offset )
+            return 0;
+    }
+
+    info.truncated = false;
+    return offset;
+}
 
-            memcpy(&buf.u32, &data[1], sizeof(buf.u32));
-            buf.u32 = be32toh(buf.u32);
+namespace {
 
-            return std::make_pair(5, CborValue(buf.value));
+typedef std::map<CborValue, CborValue> CborMap;
+
+// An array or a map which is being filled by the decoder.
+struct ReaderFrame
+{
+    bool isMap;
+    bool hasKey;
+    uint64_t remaining; // items for arrays, key/value pairs for maps
+    CborValue container;
+    // Payload of the container, it is not shared until the container is done.
+    std::vector<CborValue> *array;
+    CborMap *map;
+    CborValue key;
+};
+
+// Strings of a stringref namespace (tag 256) by their indexes. The namespace
+// ends with the item which was tagged, at the same depth.
+struct StringNamespace
+{
+    size_t depth;
+    std::vector<CborValue> strings;
+};
+
+// A shareable item (tag 28) which is being read at the depth.
+struct PendingShare
+{
+    size_t depth;
+    size_t index;
+};
+
+// Recycled strings and vectors sorted by capacity, so a request can be served
+// by storage that is big enough without reallocation. The storage is kept
+// together with its reference counter, so reusing it allocates nothing.
+template<typename T>
+class StoragePool
+{
+public:
+    // Sets allocated if no storage was there and a new one is made.
+    CborShared<T> take(size_t size, bool &allocated)
+    {
+        allocated = false;
+
+        std::vector< CborShared<T> > &lower = buckets[bucket(size, false)];
+
+        if( lower.empty() == false && lower.back().get().capacity() >= size )
+        {
+            CborShared<T> result = std::move(lower.back());
+            lower.pop_back();
+            return result;
         }
-        case DoublePrecisionFloat: {
-            if( size < 9 )
+
+        for(size_t i = bucket(size, true); i < BucketsCount; ++i)
+        {
+            if( buckets[i].empty() == false )
             {
-                std::cerr << "Unexpected end of data" << std::endl;
-                return std::make_pair(0, CborValue());
+                CborShared<T> result = std::move(buckets[i].back());
+                buckets[i].pop_back();
+                return result;
             }
+        }
 
-            union {
-                uint64_t u64;
-                double value;
-            } buf;
+        allocated = true;
+        return CborShared<T>(T());
+    }
 
-            memcpy(&buf.u64, &data[1], sizeof(buf.u64));
-            buf.u64 = be64toh(buf.u64);
+    // The storage must not be shared with any value.
+    void put(CborShared<T> &storage)
+    {
+        size_t capacity = storage.get().capacity();
 
-            return std::make_pair(9, CborValue(buf.value));
-        }
+        storage.mutate().clear();
+        buckets[bucket(capacity, false)].push_back(std::move(storage));
     }
 
-    std::cerr << "Internal error: invalid minor type " << static_cast<int>(minorType)
-              << " for simple value" << std::endl;
-    assert(false);
+private:
+    enum { BucketsCount = 64 };
 
-    return std::make_pair(0, CborValue());
-}
+    // Bucket i holds storage with capacity of at least 2^i.
+    static size_t bucket(size_t capacity, bool roundUp)
+    {
+        if( capacity <= 1 )
+            return 0;
 
-std::pair<size_t, CborValue> readByteString(uint8_t minorType, const unsigned char *data, size_t size)
+        size_t log = 63 - __builtin_clzll(capacity);
+
+        if( roundUp && (capacity & (capacity - 1)) != 0 )
+            ++log;
+
+        return log;
+    }
+
+    std::vector< CborShared<T> > buckets[BucketsCount];
+};
+
+} // namespace
+
+class CborDecoder::Impl
 {
-    if( minorType == 0x1f )  // todo: 0xff break string
-        abort();
+public:
+    Impl(size_t maxDepth)
+        : maxDepth(maxDepth)
+        , collectingStats(false)
+        , namespacesCount(0)
+    {}
+
+    size_t read(const unsigned char *data, size_t size, CborValue &result);
+
+    size_t maxDepth;
+
+    bool collectingStats;
+    CborDecodeStats stats;
+
+    // The stack keeps its capacity between messages.
+    std::vector<ReaderFrame> stack;
+
+    // Open stringref namespaces, the vector keeps the tables' capacity.
+    std::vector<StringNamespace> namespaces;
+    size_t namespacesCount;
+
+    // Shareable items of the document by their indexes. An item is null
+    // while it is being read.
+    std::vector<CborValue> sharedValues;
+    std::vector<PendingShare> pendingShares;
+
+    // Storage returned by CborDecoder::recycle.
+    StoragePool< std::vector<CborValue> > arrayPool;
+    StoragePool<std::string> stringPool;
+    StoragePool< std::vector<char> > byteStringPool;
+    std::vector<CborValue::SharedMap> mapPool;
+    std::vector<CborMap::node_type> mapNodePool;
+    std::vector<CborValue::SharedRaw> rawPool;
+    std::vector<CborValue> recycleQueue;
 
-    std::pair<size_t, uint64_t> pair = readIntegerValue(minorType, data, size);
-    size_t length = pair.second;
+    // Items at these paths are kept encoded.
+    std::vector<CborPath> rawPaths;
 
-    if( pair.first == 0 )
+    void closeNamespaces(size_t count);
+
+private:
+    void countAllocation(size_t bytes)
     {
-        // empty string?
-        return std::make_pair(pair.first, CborValue(""));
+        stats.heapBytes += bytes;
+        ++stats.allocations;
     }
 
-    if( length > pair.first + size )
+    // Counts a new payload block and a buffer which grew to newHeapSize.
+    void countStorage(bool newPayload, size_t payloadSize, size_t heapSize, size_t newHeapSize)
     {
-        std::cerr << "Unexpected end of data" << std::endl;
-        return std::make_pair(0, CborValue());
+        if( newPayload )
+            countAllocation(payloadSize);
+
+        if( newHeapSize != heapSize )
+            countAllocation(newHeapSize);
     }
 
-    const char *ptr = reinterpret_cast<const char *>(data + pair.first);
-    std::vector<char> buf(ptr, ptr + length);
+    void countNode(const CborValue &value);
+
+    void insert(CborMap &map, CborValue &key, CborValue &value);
+    bool isRawPath(size_t depth) const;
+    size_t readRaw(const unsigned char *data, size_t size, CborValue &result);
+    void openNamespace(size_t depth);
+    void addString(const CborValue &value, size_t length);
+    void addTaggedString(const unsigned char *data, size_t size);
+    size_t readStringReference(const unsigned char *data, size_t size, CborValue &result);
+    size_t readSharedReference(const unsigned char *data, size_t size, CborValue &result);
+};
+
+// Checks whether the next item is at one of the raw paths.
+bool CborDecoder::Impl::isRawPath(size_t depth) const
+{
+    if( depth != 0 && stack[depth - 1].isMap && stack[depth - 1].hasKey == false )
+        return false; // a map key
+
+    for(size_t i = 0; i < rawPaths.size(); ++i)
+    {
+        const CborPath &path = rawPaths[i];
+
+        if( path.size() != depth )
+            continue;
+
+        size_t level = 0;
+
+        for(; level < depth; ++level)
+        {
+            const ReaderFrame &frame = stack[level];
 
-    return std::make_pair(pair.first + pair.second, buf);
+            if( frame.isMap )
+            {
+                if( !(frame.key == path[level]) )
+                    break;
+            }
+            else if( !(CborValue(static_cast<uint64_t>(frame.array->size())) == path[level]) )
+            {
+                break;
+            }
+        }
+
+        if( level == depth )
+            return true;
+    }
+
+    return false;
 }
 
-std::pair<size_t, CborValue> readString(uint8_t minorType, const unsigned char *data, size_t size)
+size_t CborDecoder::Impl::readRaw(const unsigned char *data, size_t size, CborValue &result)
 {
-    if( minorType == 0x1f )  // todo: 0xff break string
-        abort();
+    const char *ptr = reinterpret_cast<const char *>(data);
+    CborSkipInfo info;
+    size_t length = cborSkipItem(data, size, info);
 
-    std::pair<size_t, uint64_t> pair = readIntegerValue(minorType, data, size);
-    size_t length = pair.second;
+    if( length == 0 )
+    {
+        std::cerr << "Malformed data item" << std::endl;
+        return 0;
+    }
 
-    if( pair.first == 0 )
+    // Shareable items inside would not get their indexes.
+    if( info.hasSharing )
     {
-        // empty string?
-        return std::make_pair(pair.first, CborValue(""));
+        std::cerr << "Raw items with shared values are not supported" << std::endl;
+        return 0;
     }
 
-    if( length > pair.first + size )
+    // A raw item could refer to strings of the enclosing namespace or add
+    // strings to it, only an item with a namespace of its own is kept.
+    const unsigned char ownNamespace[] = {0xd9, 0x01, 0x00};
+
+    if( namespacesCount != 0 &&
+        (length < sizeof(ownNamespace) || memcmp(data, ownNamespace, sizeof(ownNamespace)) != 0) )
     {
-        std::cerr << "Unexpected end of data" << std::endl;
-        return std::make_pair(0, CborValue());
+        std::cerr << "Raw items inside a stringref namespace are not supported" << std::endl;
+        return 0;
     }
 
-    const char *ptr = reinterpret_cast<const char *>(data + pair.first);
+    bool newPayload = rawPool.empty();
+
+    if( newPayload )
+        rawPool.push_back(CborValue::SharedRaw(CborValue::Raw()));
+
+    CborValue::SharedRaw raw = std::move(rawPool.back());
+    size_t heapSize = cborHeapSize(raw.get().data);
+
+    rawPool.pop_back();
+    raw.mutate().data.assign(ptr, ptr + length);
+
+    if( collectingStats )
+        countStorage(newPayload, CborValue::SharedRaw::allocationSize(), heapSize, cborHeapSize(raw.get().data));
+
+    result.value = std::move(raw);
+
+    return length;
+}
+
+void CborDecoder::Impl::openNamespace(size_t depth)
+{
+    if( namespacesCount == namespaces.size() )
+        namespaces.push_back(StringNamespace());
+
+    namespaces[namespacesCount++].depth = depth;
+}
+
+// Closes the innermost namespaces down to count. The tables release their
+// strings, so the decoded values own them alone.
+void CborDecoder::Impl::closeNamespaces(size_t count)
+{
+    for(; namespacesCount > count; --namespacesCount)
+        namespaces[namespacesCount - 1].strings.clear();
+}
 
-    return std::make_pair(pair.first + pair.second, std::string(ptr, ptr + length));
+void CborDecoder::Impl::addString(const CborValue &value, size_t length)
+{
+    std::vector<CborValue> &strings = namespaces[namespacesCount - 1].strings;
+
+    if( cborIsStringReferenceCandidate(length, strings.size()) )
+        strings.push_back(value);
 }
 
-std::pair<size_t, CborValue> readArray(uint8_t minorType, const unsigned char *data, size_t size)
+// The content of tags 0, 2 and 3 is a string of the namespace as well. It was
+// decoded already, so it is valid.
+void CborDecoder::Impl::addTaggedString(const unsigned char *data, size_t size)
 {
-    if( minorType == 0x1f )  // todo: 0xff break array
-        abort();
+    size_t length = 0;
+    size_t headerSize = readStringHeader(data, size, length);
+    const char *begin = reinterpret_cast<const char *>(data + headerSize);
 
-    std::pair<size_t, uint64_t> pair = readIntegerValue(minorType, data, size);
-    size_t offset = pair.first;
+    if( !cborIsStringReferenceCandidate(length, namespaces[namespacesCount - 1].strings.size()) )
+        return;
 
-    if( pair.first == 0 )
+    if( cborInitialBytes[data[0]].kind == CborItemString )
+        addString(CborValue(std::string(begin, length)), length);
+    else
+        addString(CborValue(std::vector<char>(begin, begin + length)), length);
+}
+
+// Tag 25: the index of a string of the innermost namespace.
+size_t CborDecoder::Impl::readStringReference(const unsigned char *data, size_t size,
+                                              CborValue &result)
+{
+    uint64_t index = 0;
+    size_t length = 0;
+
+    if( size != 0 && cborInitialBytes[data[0]].kind == CborItemUnsigned )
+        length = readArgument(data, size, index);
+
+    if( length == 0 || namespacesCount == 0 ||
+        index >= namespaces[namespacesCount - 1].strings.size() )
     {
-        // empty array?
-        return std::make_pair(pair.first, CborValue(std::vector<CborValue>()));
+        std::cerr << "Invalid string reference" << std::endl;
+        return 0;
     }
 
-    std::vector<CborValue> result;
+    result = namespaces[namespacesCount - 1].strings[index];
+    return length;
+}
 
-    result.reserve(pair.second);
+// Tag 29: the index of a shareable item read before.
+size_t CborDecoder::Impl::readSharedReference(const unsigned char *data, size_t size,
+                                              CborValue &result)
+{
+    uint64_t index = 0;
+    size_t length = 0;
 
-    for(size_t i = 0; i < pair.second; ++i)
+    if( size != 0 && cborInitialBytes[data[0]].kind == CborItemUnsigned )
+        length = readArgument(data, size, index);
+
+    if( length == 0 || index >= sharedValues.size() )
     {
-        if( offset >= size )
+        std::cerr << "Invalid shared reference" << std::endl;
+        return 0;
+    }
+
+    for(size_t i = 0; i < pendingShares.size(); ++i)
+    {
+        if( pendingShares[i].index == index )
         {
-            std::cerr << "Unexpected end of data" << std::endl;
-            return std::make_pair(0, CborValue());
+            std::cerr << "Cyclic shared references are not supported" << std::endl;
+            return 0;
         }
-
-        std::pair<size_t, CborValue> pair = internalRead(data + offset, size - offset);
-
-        offset += pair.first;
-        result.push_back(pair.second);
     }
 
-    return std::make_pair(offset, result);
+    result = sharedValues[index];
+    return length;
 }
 
-std::pair<size_t, CborValue> readMap(uint8_t minorType, const unsigned char *data, size_t size)
+void CborDecoder::Impl::insert(CborMap &map, CborValue &key, CborValue &value)
 {
-    if( minorType == 0x1f )  // todo: 0xff break array
-        abort();
+    if( mapNodePool.empty() )
+    {
+        size_t count = map.size();
+
+        map[std::move(key)] = std::move(value);
+
+        if( collectingStats && map.size() != count )
+            countAllocation(cborMapNodeSize);
+
+        return;
+    }
+
+    CborMap::node_type node = std::move(mapNodePool.back());
+    mapNodePool.pop_back();
 
-    std::pair<size_t, uint64_t> pair = readIntegerValue(minorType, data, size);
-    size_t offset = pair.first;
+    node.key() = std::move(key);
+    node.mapped() = std::move(value);
 
-    if( pair.first == 0 )
+    CborMap::insert_return_type inserted = map.insert(std::move(node));
+
+    if( !inserted.inserted )
     {
-        // empty map?
-        return std::make_pair(pair.first, std::map<CborValue, CborValue>());
+        // Duplicate key: the last value wins.
+        inserted.position->second = std::move(inserted.node.mapped());
+        mapNodePool.push_back(std::move(inserted.node));
     }
+}
 
-    std::map<CborValue, CborValue> result;
+void CborDecoder::Impl::countNode(const CborValue &value)
+{
+    ++stats.nodes[value.type()];
+
+    if( const std::string *string = value.getIf<std::string>() )
+        stats.stringBytes += string->size();
+    else if( const std::vector<char> *bytes = value.getIf< std::vector<char> >() )
+        stats.stringBytes += bytes->size();
+}
 
-    for(size_t i = 0; i < pair.second; ++i)
+// Decodes one data item without recursion. Nested arrays and maps are kept in
+// an explicit stack, which is never deeper than maxDepth. Returns the size of
+// the item in bytes or 0 on error.
+size_t CborDecoder::Impl::read(const unsigned char *data, size_t size, CborValue &result)
+{
+    size_t offset = 0;
+    size_t depth = 0;
+
+    for(;;)
     {
         if( offset >= size )
         {
             std::cerr << "Unexpected end of data" << std::endl;
-            return std::make_pair(0, CborValue());
+            return 0;
+        }
+
+        const unsigned char *ptr = data + offset;
+        size_t available = size - offset;
+        size_t length = 0;
+        CborValue value;
+
+        if( rawPaths.empty() == false && isRawPath(depth) )
+        {
+            length = readRaw(ptr, available, value);
         }
+        else
+        {
+            uint8_t kind = cborInitialBytes[ptr[0]].kind;
+            uint64_t argument = 0;
+
+            switch(kind)
+            {
+                case CborItemUnsigned:
+                    length = readArgument(ptr, available, argument);
+                    value = CborValue(argument);
+                    break;
+                case CborItemNegative:
+                    length = readArgument(ptr, available, argument);
+                    readNegativeInteger(argument, value);
+                    break;
+                case CborItemBytes:
+                case CborItemString: {
+                    size_t stringLength = 0;
+                    size_t headerSize = readStringHeader(ptr, available, stringLength);
+
+                    if( headerSize == 0 )
+                        return 0;
+
+                    const char *begin = reinterpret_cast<const char *>(ptr + headerSize);
+
+                    if( kind == CborItemBytes )
+                    {
+                        bool newPayload = false;
+                        CborValue::SharedByteString bytes = byteStringPool.take(stringLength, newPayload);
+                        size_t heapSize = cborHeapSize(bytes.get());
+
+                        bytes.mutate().assign(begin, begin + stringLength);
+
+                        if( collectingStats )
+                            countStorage(newPayload, CborValue::SharedByteString::allocationSize(),
+                                         heapSize, cborHeapSize(bytes.get()));
+
+                        value.value = std::move(bytes);
+                    }
+                    else
+                    {
+                        bool newPayload = false;
+                        CborValue::SharedString string = stringPool.take(stringLength, newPayload);
+                        size_t heapSize = cborHeapSize(string.get());
+
+                        string.mutate().assign(begin, stringLength);
+
+                        if( collectingStats )
+                            countStorage(newPayload, CborValue::SharedString::allocationSize(),
+                                         heapSize, cborHeapSize(string.get()));
+
+                        value.value = std::move(string);
+                    }
+
+                    if( namespacesCount != 0 )
+                        addString(value, stringLength);
+
+                    length = headerSize + stringLength;
+                    break;
+                }
+                case CborItemArray:
+                case CborItemMap: {
+                    size_t headerSize = readArgument(ptr, available, argument);
+
+                    if( headerSize == 0 )
+                        return 0;
+
+                    // Every item takes at least one byte, so a larger count can
+                    // not be satisfied and must not be used to reserve memory.
+                    uint64_t itemsCount = kind == CborItemMap ? argument * 2 : argument;
+
+                    if( argument > available || itemsCount > available - headerSize )
+                    {
+                        std::cerr << "Unexpected end of data" << std::endl;
+                        return 0;
+                    }
+
+                    if( collectingStats )
+                        stats.maxDepth = std::max<size_t>(stats.maxDepth, depth + 1);
+
+                    if( argument == 0 )
+                    {
+                        length = headerSize;
+                        // Empty containers are shared by all decoded values.
+                        value = kind == CborItemMap ? cborSharedEmptyMap() : cborSharedEmptyArray();
+                        break;
+                    }
+
+                    if( depth >= maxDepth )
+                    {
+                        std::cerr << "Maximum nesting depth exceeded" << std::endl;
+                        return 0;
+                    }
+
+                    offset += headerSize;
+
+                    if( depth == stack.size() )
+                        stack.push_back(ReaderFrame());
+
+                    ReaderFrame &frame = stack[depth++];
+                    frame.isMap = kind == CborItemMap;
+                    frame.hasKey = false;
+                    frame.remaining = argument;
+
+                    if( !frame.isMap )
+                    {
+                        bool newPayload = false;
+                        CborValue::SharedArray array = arrayPool.take(argument, newPayload);
+                        size_t heapSize = cborHeapSize(array.get());
+
+                        frame.array = &array.mutate();
+                        frame.array->reserve(argument);
+
+                        if( collectingStats )
+                            countStorage(newPayload, CborValue::SharedArray::allocationSize(),
+                                         heapSize, cborHeapSize(*frame.array));
+
+                        frame.container.value = std::move(array);
+                    }
+                    else
+                    {
+                        if( mapPool.empty() )
+                        {
+                            mapPool.push_back(CborValue::SharedMap(CborMap()));
+
+                            if( collectingStats )
+                                countAllocation(CborValue::SharedMap::allocationSize());
+                        }
+
+                        frame.map = &mapPool.back().mutate();
+                        frame.container.value = std::move(mapPool.back());
+                        mapPool.pop_back();
+                    }
+
+                    continue;
+                }
+                case CborItemTag: {
+                    size_t headerSize = readArgument(ptr, available, argument);
+
+                    if( headerSize == 0 )
+                        return 0;
+
+                    if( argument == StringReferenceNamespace )
+                    {
+                        // The tagged item is read as the next one.
+                        openNamespace(depth);
+                        offset += headerSize;
+                        continue;
+                    }
+
+                    if( argument == Shareable )
+                    {
+                        PendingShare share = {depth, sharedValues.size()};
+
+                        pendingShares.push_back(share);
+                        sharedValues.push_back(CborValue());
+                        offset += headerSize;
+                        continue;
+                    }
+
+                    if( argument == SharedReference )
+                    {
+                        length = readSharedReference(ptr + headerSize, available - headerSize, value);
+                        length = length == 0 ? 0 : headerSize + length;
+                        break;
+                    }
+
+                    if( argument == StringReference )
+                    {
+                        length = readStringReference(ptr + headerSize, available - headerSize, value);
+                        length = length == 0 ? 0 : headerSize + length;
+                        break;
+                    }
+
+                    length = readTagger(ptr, available, value);
+
+                    if( length != 0 && namespacesCount != 0 &&
+                        (argument == TextBasedDateTime || argument == PositiveBignum ||
+                         argument == NegativeBignum) )
+                    {
+                        addTaggedString(ptr + headerSize, available - headerSize);
+                    }
+                    break;
+                }
+                case CborItemFalse:
+                    value = CborValue(false);
+                    length = 1;
+                    break;
+                case CborItemTrue:
+                    value = CborValue(true);
+                    length = 1;
+                    break;
+                case CborItemNull:
+                    value = CborValue(CborValue::NullTag());
+                    length = 1;
+                    break;
+                case CborItemUndefined:
+                    value = CborValue(CborValue::UndefinedTag());
+                    length = 1;
+                    break;
+                case CborItemHalf:
+                    length = readArgument(ptr, available, argument);
+                    value = CborValue(cborReadHalf(argument));
+                    break;
+                case CborItemFloat:
+                    length = readArgument(ptr, available, argument);
+                    value = CborValue(cborReadFloat(argument));
+                    break;
+                case CborItemDouble:
+                    length = readArgument(ptr, available, argument);
+                    value = CborValue(cborReadDouble(argument));
+                    break;
+                default:
+                    reportUnsupported(ptr[0]);
+                    return 0;
+            }
+        }
+
+        if( length == 0 )
+            return 0;
+
+        offset += length;
+
+        // Bignums longer than the inline bytes, read or copied by a shared
+        // reference.
+        if( collectingStats && value.type() == CborValue::BigIntegerType &&
+            value.getIf<CborValue::BigInteger>()->bigint.size() > CborSmallBytes::InlineCapacity )
+        {
+            countAllocation(value.getIf<CborValue::BigInteger>()->bigint.size());
+        }
+
+        // Hand the finished item to its parent container. Completing the
+        // last item of a container completes the container itself.
+        for(;;)
+        {
+            if( collectingStats )
+                countNode(value);
 
-        std::pair<size_t, CborValue> pair1 = internalRead(data + offset, size - offset);
-        std::pair<size_t, CborValue> pair2 = internalRead(data + offset + pair1.first, size - offset - pair1.first);
+            while( pendingShares.empty() == false && pendingShares.back().depth == depth )
+            {
+                sharedValues[pendingShares.back().index] = value;
+                pendingShares.pop_back();
+            }
 
-        assert( pair1.first != 0 );
-        assert( pair2.first != 0 );
+            while( namespacesCount != 0 && namespaces[namespacesCount - 1].depth == depth )
+                closeNamespaces(namespacesCount - 1);
 
-        offset += pair1.first;
-        offset += pair2.first;
+            if( depth == 0 )
+            {
+                result = std::move(value);
+                return offset;
+            }
+
+            ReaderFrame &top = stack[depth - 1];
 
-        result[pair1.second] = pair2.second;
+            if( top.isMap )
+            {
+                if( !top.hasKey )
+                {
+                    top.key = std::move(value);
+                    top.hasKey = true;
+                    break;
+                }
+
+                insert(*top.map, top.key, value);
+                top.hasKey = false;
+            }
+            else
+            {
+                top.array->push_back(std::move(value));
+            }
+
+            if( --top.remaining != 0 )
+                break;
+
+            value = std::move(top.container);
+            --depth;
+        }
     }
+}
 
-    return std::make_pair(offset, result);
+CborDecodeStats::CborDecodeStats()
+    : maxDepth(0)
+    , stringBytes(0)
+    , heapBytes(0)
+    , allocations(0)
+{
+    std::fill(nodes, nodes + sizeof(nodes) / sizeof(nodes[0]), 0);
 }
 
-std::pair<size_t, CborValue> readBignum(const unsigned char *data, size_t size, bool positive)
+CborDecoder::CborDecoder(size_t maxDepth)
+    : pimpl(new Impl(maxDepth))
 {
-    CborValue::BigInteger bigInteger;
-    std::pair<size_t, CborValue> pair = internalRead(data, size);
+}
 
-    if( pair.first == 0 )
-    {
-        // fail?
-        return std::make_pair(pair.first, CborValue());
-    }
+CborDecoder::~CborDecoder()
+{
+}
+
+size_t CborDecoder::maxDepth() const
+{
+    return pimpl->maxDepth;
+}
 
-    std::vector<char> binaryString = pair.second.toByteString();
+void CborDecoder::setMaxDepth(size_t maxDepth)
+{
+    pimpl->maxDepth = maxDepth;
+}
 
-    if( !positive )
+void CborDecoder::addRawPath(const CborPath &path)
+{
+    pimpl->rawPaths.push_back(path);
+}
+
+void CborDecoder::clearRawPaths()
+{
+    pimpl->rawPaths.clear();
+}
+
+bool CborDecoder::isCollectingStats() const
+{
+    return pimpl->collectingStats;
+}
+
+void CborDecoder::setCollectingStats(bool collectingStats)
+{
+    pimpl->collectingStats = collectingStats;
+}
+
+const CborDecodeStats &CborDecoder::lastStats() const
+{
+    return pimpl->stats;
+}
+
+bool CborDecoder::read(const char *data, size_t size, CborValue &result)
+{
+    if( pimpl->collectingStats )
+        pimpl->stats = CborDecodeStats();
+
+    bool success = size != 0 &&
+            pimpl->read(reinterpret_cast<const unsigned char *>(data), size, result) != 0;
+
+    // Namespaces are left open by malformed data. The shared values are
+    // owned by the result alone.
+    pimpl->closeNamespaces(0);
+    pimpl->sharedValues.clear();
+    pimpl->pendingShares.clear();
+
+    if( !success )
+        result = CborValue();
+
+    return success;
+}
+
+CborValue CborDecoder::read(const std::vector<char> &data)
+{
+    CborValue result;
+
+    read(data.data(), data.size(), result);
+    return result;
+}
+
+void CborDecoder::recycle(CborValue &value)
+{
+    // Walk the tree with an explicit queue, it may be nested deeply. Storage
+    // still shared with other values is left to them.
+    std::vector<CborValue> &queue = pimpl->recycleQueue;
+
+    queue.push_back(std::move(value));
+    value = CborValue();
+
+    while( queue.empty() == false )
     {
-        for(size_t i = binaryString.size(); i != 0 ; --i)
+        CborValue item = std::move(queue.back());
+        queue.pop_back();
+
+        if( CborValue::SharedArray *array = boost::get<CborValue::SharedArray>(&item.value) )
         {
-            unsigned char c = static_cast<unsigned char>(binaryString[i - 1]);
-            if( c == 0xff )
+            if( array->unique() == false )
+                continue;
+
+            std::vector<CborValue> &items = array->mutate();
+
+            for(size_t i = 0; i < items.size(); ++i)
             {
-                binaryString[i - 1] = 0;
+                if( items[i].type() >= CborValue::StringType )
+                    queue.push_back(std::move(items[i]));
             }
-            else
+
+            pimpl->arrayPool.put(*array);
+        }
+        else if( CborValue::SharedMap *map = boost::get<CborValue::SharedMap>(&item.value) )
+        {
+            if( map->unique() == false )
+                continue;
+
+            CborMap &entries = map->mutate();
+
+            while( entries.empty() == false )
             {
-                binaryString[i - 1] = c + 1u;
-                break;
+                CborMap::node_type node = entries.extract(entries.begin());
+
+                queue.push_back(std::move(node.key()));
+                queue.push_back(std::move(node.mapped()));
+                pimpl->mapNodePool.push_back(std::move(node));
+            }
+
+            pimpl->mapPool.push_back(std::move(*map));
+        }
+        else if( CborValue::SharedString *string = boost::get<CborValue::SharedString>(&item.value) )
+        {
+            if( string->unique() )
+                pimpl->stringPool.put(*string);
+        }
+        else if( CborValue::SharedByteString *bytes = boost::get<CborValue::SharedByteString>(&item.value) )
+        {
+            if( bytes->unique() )
+                pimpl->byteStringPool.put(*bytes);
+        }
+        else if( CborValue::SharedRaw *raw = boost::get<CborValue::SharedRaw>(&item.value) )
+        {
+            if( raw->unique() )
+            {
+                raw->mutate().data.clear();
+                pimpl->rawPool.push_back(std::move(*raw));
             }
         }
     }
+}
 
-    bigInteger.positive = positive;
-    bigInteger.bigint.assign(binaryString.begin(), binaryString.end());
+size_t cborItemSize(const char *data, size_t size)
+{
+    CborSkipInfo info;
 
+    return cborSkipItem(reinterpret_cast<const unsigned char *>(data), size, info);
+}
+
+CborValue cborRead(const std::vector<char> &data, size_t maxDepth)
+{
+    CborDecoder decoder(maxDepth);
 
-    return std::make_pair(pair.first, bigInteger);
+    return decoder.read(data);
 }
 
+namespace {
 
-std::pair<size_t, CborValue> readTagger(uint8_t minorType, const unsigned char *data, size_t size)
+// Messages stored in separate buffers.
+struct BufferList
 {
-    switch(minorType)
+    BufferList(const std::vector< std::vector<char> > &buffers)
+        : buffers(buffers)
+    {}
+
+    size_t size() const
     {
-        case TextBasedDateTime:
-            break;
-        case EpochBasedDateTime:
-            break;
-        case PositiveBignum:
-            return readBignum(data + 1, size - 1, true);
-            break;
-        case NegativeBignum:
-            return readBignum(data + 1, size - 1, false);
-            break;
-        case DecimalFraction:
-            break;
-        case BigFloat:
-            break;
+        return buffers.size();
     }
 
-    std::cerr << "Internal error: invalid minor type for tagger value"
-              << static_cast<int>(minorType) << std::endl;
-    assert(false);
+    const unsigned char *data(size_t index) const
+    {
+        return reinterpret_cast<const unsigned char *>(buffers[index].data());
+    }
 
-    return std::make_pair(0, CborValue());
-}
+    size_t length(size_t index) const
+    {
+        return buffers[index].size();
+    }
+
+    const std::vector< std::vector<char> > &buffers;
+};
 
-static std::pair<size_t, CborValue> internalRead(const unsigned char *data, size_t size)
+// Messages stored back to back in one buffer.
+struct OffsetList
 {
-    unsigned char majorType = (data[0] & 0xe0) >> 5;
-    unsigned char minorType = (data[0] & 0x1f);
+    OffsetList(const std::vector<char> &buffer, const std::vector<size_t> &offsets)
+        : buffer(buffer), offsets(offsets)
+    {}
 
-    switch(majorType)
+    size_t size() const
     {
-        case UnsignedInt:
-            // Unsigned integer
-            return readPositiveInteger(minorType, data, size + 1);
-            break;
-        case NegativeInt:
-            // Negative integer
-            return readNegativeInteger(minorType, data, size + 1);
-            break;
-        case Bytes:
-            // Byte string
-            return readByteString(minorType, data, size + 1);
-            break;
-        case Utf8String:
-            // Utf-8 string
-            return readString(minorType, data, size + 1);
-            break;
-        case Array:
-            // Array
-            return readArray(minorType, data, size + 1);
-            break;
-        case Map:
-            // Map
-            return readMap(minorType, data, size + 1);
-            break;
-        case Tag:
-            // Tagged
-            return readTagger(minorType, data, size + 1);
-            break;
-        case Prim:
-            // Simple or float
-            return simpleOrFloat(minorType, data, size + 1);
-            break;
+        return offsets.size();
     }
 
-    std::cerr << "Internal error: invalid type " << static_cast<int>(majorType) << " "
-              << static_cast<int>(minorType) << std::endl;
-    assert(false);
+    const unsigned char *data(size_t index) const
+    {
+        return reinterpret_cast<const unsigned char *>(buffer.data()) + offsets[index];
+    }
+
+    size_t length(size_t index) const
+    {
+        size_t end = index + 1 < offsets.size() ? offsets[index + 1] : buffer.size();
+
+        if( offsets[index] > end || end > buffer.size() )
+            return 0;
+
+        return end - offsets[index];
+    }
+
+    const std::vector<char> &buffer;
+    const std::vector<size_t> &offsets;
+};
+
+template<typename Messages>
+void readRange(const Messages &messages, size_t first, size_t last, size_t maxDepth,
+               std::vector<CborValue> &results, size_t &decodedCount)
+{
+    CborDecoder decoder(maxDepth);
+
+    decodedCount = 0;
+
+    for(size_t i = first; i < last; ++i)
+    {
+        // Values left from the previous batch feed the decoder's pools.
+        decoder.recycle(results[i]);
 
-    return std::make_pair(0, CborValue());
+        const char *data = reinterpret_cast<const char *>(messages.data(i));
+
+        if( decoder.read(data, messages.length(i), results[i]) )
+            ++decodedCount;
+    }
 }
 
-CborValue cborRead(const std::vector<char> &data)
+template<typename Messages>
+size_t readBatch(const Messages &messages, std::vector<CborValue> &results,
+                 size_t threadsCount, size_t maxDepth)
 {
-    if( data.empty() )
-        return CborValue();
+    size_t count = messages.size();
+
+    results.resize(count);
+
+    if( threadsCount > count )
+        threadsCount = count;
+
+    if( threadsCount <= 1 )
+    {
+        size_t decodedCount = 0;
+
+        readRange(messages, 0, count, maxDepth, results, decodedCount);
+        return decodedCount;
+    }
+
+    // Every thread decodes a contiguous range of messages with its own
+    // stack and writes only to its own slots of the results.
+    std::vector<std::thread> threads;
+    std::vector<size_t> decodedCounts(threadsCount, 0);
+    size_t chunk = (count + threadsCount - 1) / threadsCount;
+
+    threads.reserve(threadsCount);
+
+    for(size_t i = 0; i < threadsCount; ++i)
+    {
+        size_t first = std::min(count, i * chunk);
+        size_t last = std::min(count, first + chunk);
 
-    return internalRead(reinterpret_cast<const unsigned char *>(data.data()), data.size()).second;
+        threads.push_back(std::thread(readRange<Messages>, std::cref(messages), first, last,
+                                      maxDepth, std::ref(results), std::ref(decodedCounts[i])));
+    }
+
+    size_t decodedCount = 0;
+
+    for(size_t i = 0; i < threadsCount; ++i)
+    {
+        threads[i].join();
+        decodedCount += decodedCounts[i];
+    }
+
+    return decodedCount;
 }
 
+} // namespace
+
+size_t cborReadBatch(const std::vector< std::vector<char> > &buffers,
+                     std::vector<CborValue> &results,
+                     size_t threadsCount, size_t maxDepth)
+{
+    return readBatch(BufferList(buffers), results, threadsCount, maxDepth);
+}
+
+size_t cborReadBatch(const std::vector<char> &data, const std::vector<size_t> &offsets,
+                     std::vector<CborValue> &results,
+                     size_t threadsCount, size_t maxDepth)
+{
+    return readBatch(OffsetList(data, offsets), results, threadsCount, maxDepth);
+}
@@ -8,8 +8,87 @@
 
 #include <vector>
 
+#include <boost/scoped_ptr.hpp>
+
 #include "cborvalue.h"
 
-CborValue cborRead(const std::vector<char> &data);
+// Maximum nesting level of arrays and maps accepted by the reader.
+static const size_t cborDefaultMaxDepth = 512;
+
+// Returns a null value if the data is malformed or nested deeper than maxDepth.
+CborValue cborRead(const std::vector<char> &data, size_t maxDepth = cborDefaultMaxDepth);
+
+// Returns the size of the data item at the start of data, or 0 if the item is
+// malformed or truncated. The item is skipped without being decoded.
+size_t cborItemSize(const char *data, size_t size);
+
+// What one CborDecoder::read() produced. The heap figures cover the storage
+// of the result which was not served from the decoder's pools, sized as by
+// CborValue::memoryUsage(); the decoder's own stack and tables are not
+// included, nor are the empty arrays and maps which all results share and
+// memoryUsage() skips as well.
+struct CborDecodeStats
+{
+    CborDecodeStats();
+
+    size_t nodes[CborValue::BigFloatType + 1]; // values by CborValue::Type, map keys included
+    size_t maxDepth;    // nesting of arrays and maps, 0 for a scalar
+    size_t stringBytes; // payload of text and byte strings
+    size_t heapBytes;   // allocated for the result
+    size_t allocations;
+};
+
+// Long-lived decoder. It keeps its stack between messages and reuses the
+// storage of values given back with recycle(), so decoding steady traffic
+// allocates almost nothing.
+class CborDecoder {
+public:
+    CborDecoder(size_t maxDepth = cborDefaultMaxDepth);
+    ~CborDecoder();
+
+    size_t maxDepth() const;
+    void setMaxDepth(size_t maxDepth);
+
+    // Returns false and sets result to null if the data is malformed.
+    bool read(const char *data, size_t size, CborValue &result);
+    CborValue read(const std::vector<char> &data);
+
+    // Statistics of every read(), off by default: they cost a few counters
+    // per item. After a failed read() they cover the data up to the error.
+    bool isCollectingStats() const;
+    void setCollectingStats(bool collectingStats);
+    const CborDecodeStats &lastStats() const;
+
+    // Items at the path (map keys and array indexes from the root) are not
+    // decoded but returned as raw values, which cborWrite copies verbatim.
+    void addRawPath(const CborPath &path);
+    void clearRawPaths();
+
+    // Takes the containers and strings of a value which is not needed anymore
+    // into the decoder's pools. The value becomes null.
+    void recycle(CborValue &value);
+
+private:
+    CborDecoder(const CborDecoder &);
+    CborDecoder &operator = (const CborDecoder &);
+
+    class Impl;
+    boost::scoped_ptr<Impl> pimpl;
+};
+
+// Decodes many small messages at once. results is resized to the number of
+// messages and keeps its capacity between batches; a message that can not be
+// decoded leaves a null value in its slot. With threadsCount > 1 the batch is
+// split into contiguous ranges decoded in parallel. Returns the number of
+// successfully decoded messages.
+size_t cborReadBatch(const std::vector< std::vector<char> > &buffers,
+                     std::vector<CborValue> &results,
+                     size_t threadsCount = 1, size_t maxDepth = cborDefaultMaxDepth);
+
+// The same for messages stored back to back in one buffer. Message i starts
+// at offsets[i] and ends at offsets[i + 1] or at the end of the data.
+size_t cborReadBatch(const std::vector<char> &data, const std::vector<size_t> &offsets,
+                     std::vector<CborValue> &results,
+                     size_t threadsCount = 1, size_t maxDepth = cborDefaultMaxDepth);
 
 #endif // CBORREADER_H
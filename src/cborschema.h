@@ -0,0 +1,375 @@
+/*
+ * Copyright (C) Alex Nekipelov (alex@nekipelov.net)
+ * License: MIT
+ */
+
+#ifndef CBORSCHEMA_H
+#define CBORSCHEMA_H
+
+// Decoders generated at compile time for a known message shape. Requires
+// C++20 string literals as template arguments.
+#if defined(__cpp_nontype_template_args) && __cpp_nontype_template_args >= 201911L
+
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "cborprivate.h"
+
+// A map decoded straight into a struct:
+//
+//   struct Point { int32_t x; int32_t y; };
+//   struct Shape { std::string name; std::vector<Point> points; };
+//
+//   typedef CborSchema<Point, CborField<"x", &Point::x>,
+//                             CborField<"y", &Point::y> > PointSchema;
+//   typedef CborSchema<Shape, CborField<"name", &Shape::name>,
+//                             CborField<"points", &Shape::points, PointSchema> > ShapeSchema;
+//
+//   Shape shape;
+//   size_t length = ShapeSchema::read(data, size, shape);
+//
+// A key is matched by comparing its length and then its bytes with the keys
+// of the schema, which are constants; no CborValue is built. Fields take
+// bool, integers (range checked), floating point types (integers accepted),
+// std::string, std::vector<char> for byte strings, std::vector of any of
+// these, and structs or vectors of structs with a nested schema. Unknown
+// keys are skipped, missing fields keep their values. Strings and vectors
+// reuse the capacity of the result, so decoding into the same struct again
+// does not allocate.
+
+template<size_t N>
+struct CborKey
+{
+    constexpr CborKey(const char (&key)[N])
+    {
+        for(size_t i = 0; i < N; ++i)
+            data[i] = key[i];
+    }
+
+    static constexpr size_t size = N - 1;
+    char data[N];
+};
+
+namespace cborschema {
+
+// Decoders of one item into T. Each returns the size of the item, or 0 if it
+// is malformed, truncated or has an unexpected type.
+template<typename T, typename Enable = void>
+struct Value;
+
+// Reads the header of an item of the kind, checks that size bytes follow it
+// for strings. Returns the header size or 0.
+inline size_t readHeader(const unsigned char *data, size_t size, uint8_t kind, uint64_t &argument)
+{
+    if( size == 0 || cborInitialBytes[data[0]].kind != kind )
+        return 0;
+
+    size_t headerSize = cborDecodeHeader(data, size, argument);
+
+    if( (kind == CborItemString || kind == CborItemBytes) && headerSize != 0 &&
+        argument > size - headerSize )
+    {
+        return 0;
+    }
+
+    return headerSize;
+}
+
+template<>
+struct Value<bool>
+{
+    static size_t decode(const unsigned char *data, size_t size, bool &result)
+    {
+        uint8_t kind = size == 0 ? static_cast<uint8_t>(CborItemReserved) : cborInitialBytes[data[0]].kind;
+
+        if( kind != CborItemTrue && kind != CborItemFalse )
+            return 0;
+
+        result = kind == CborItemTrue;
+        return 1;
+    }
+};
+
+template<typename T>
+struct Value<T, typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value>::type>
+{
+    static size_t decode(const unsigned char *data, size_t size, T &result)
+    {
+        uint8_t kind = size == 0 ? static_cast<uint8_t>(CborItemReserved) : cborInitialBytes[data[0]].kind;
+        uint64_t argument = 0;
+
+        if( kind != CborItemUnsigned && kind != CborItemNegative )
+            return 0;
+
+        size_t headerSize = cborDecodeHeader(data, size, argument);
+
+        if( headerSize == 0 || argument > static_cast<uint64_t>(std::numeric_limits<T>::max()) )
+            return 0;
+
+        if( kind == CborItemUnsigned )
+        {
+            result = static_cast<T>(argument);
+        }
+        else
+        {
+            // -1 - argument >= min, for unsigned types there is no such value.
+            if( !std::is_signed<T>::value )
+                return 0;
+
+            result = static_cast<T>(-1 - static_cast<int64_t>(argument));
+        }
+
+        return headerSize;
+    }
+};
+
+template<typename T>
+struct Value<T, typename std::enable_if<std::is_floating_point<T>::value>::type>
+{
+    static size_t decode(const unsigned char *data, size_t size, T &result)
+    {
+        uint8_t kind = size == 0 ? static_cast<uint8_t>(CborItemReserved) : cborInitialBytes[data[0]].kind;
+        uint64_t argument = 0;
+        size_t headerSize = 0;
+
+        switch(kind)
+        {
+            case CborItemHalf:
+                headerSize = cborDecodeHeader(data, size, argument);
+                result = static_cast<T>(cborReadHalf(argument));
+                break;
+            case CborItemFloat:
+                headerSize = cborDecodeHeader(data, size, argument);
+                result = static_cast<T>(cborReadFloat(argument));
+                break;
+            case CborItemDouble:
+                headerSize = cborDecodeHeader(data, size, argument);
+                result = static_cast<T>(cborReadDouble(argument));
+                break;
+            case CborItemUnsigned:
+                headerSize = cborDecodeHeader(data, size, argument);
+                result = static_cast<T>(argument);
+                break;
+            case CborItemNegative:
+                headerSize = cborDecodeHeader(data, size, argument);
+                result = -1 - static_cast<T>(argument);
+                break;
+        }
+
+        return headerSize;
+    }
+};
+
+template<>
+struct Value<std::string>
+{
+    static size_t decode(const unsigned char *data, size_t size, std::string &result)
+    {
+        uint64_t length = 0;
+        size_t headerSize = readHeader(data, size, CborItemString, length);
+
+        if( headerSize != 0 )
+            result.assign(reinterpret_cast<const char *>(data + headerSize), length);
+
+        return headerSize == 0 ? 0 : headerSize + length;
+    }
+};
+
+template<>
+struct Value< std::vector<char> >
+{
+    static size_t decode(const unsigned char *data, size_t size, std::vector<char> &result)
+    {
+        uint64_t length = 0;
+        size_t headerSize = readHeader(data, size, CborItemBytes, length);
+        const char *begin = reinterpret_cast<const char *>(data + headerSize);
+
+        if( headerSize != 0 )
+            result.assign(begin, begin + length);
+
+        return headerSize == 0 ? 0 : headerSize + length;
+    }
+};
+
+// An array of items decoded by Element.
+template<typename T, typename Element>
+struct ArrayValue
+{
+    static size_t decode(const unsigned char *data, size_t size, std::vector<T> &result)
+    {
+        uint64_t count = 0;
+        size_t offset = readHeader(data, size, CborItemArray, count);
+
+        // Every item takes at least one byte.
+        if( offset == 0 || count > size - offset )
+            return 0;
+
+        result.resize(count);
+
+        for(size_t i = 0; i < count; ++i)
+        {
+            size_t length = decodeItem(data + offset, size - offset, result[i]);
+
+            if( length == 0 )
+                return 0;
+
+            offset += length;
+        }
+
+        return offset;
+    }
+
+private:
+    template<typename Item>
+    static size_t decodeItem(const unsigned char *data, size_t size, Item &item)
+    {
+        return Element::decode(data, size, item);
+    }
+
+    // Items of std::vector<bool> are proxies, they are decoded through a bool.
+    static size_t decodeItem(const unsigned char *data, size_t size, std::vector<bool>::reference item)
+    {
+        bool value = false;
+        size_t length = Element::decode(data, size, value);
+
+        item = value;
+        return length;
+    }
+};
+
+template<typename T>
+struct Value<std::vector<T>, typename std::enable_if<!std::is_same<T, char>::value>::type>
+    : ArrayValue< T, Value<T> >
+{
+};
+
+// The decoder of a field: by the type or by the nested schema.
+template<typename T, typename Schema>
+struct FieldValue : Schema
+{
+};
+
+template<typename T>
+struct FieldValue<T, void> : Value<T>
+{
+};
+
+template<typename T, typename Schema>
+struct FieldValue<std::vector<T>, Schema>
+    : ArrayValue< T, FieldValue<T, Schema> >
+{
+};
+
+template<typename T>
+struct FieldValue<std::vector<T>, void> : Value< std::vector<T> >
+{
+};
+
+template<typename T>
+struct MemberPointer;
+
+template<typename Class, typename T>
+struct MemberPointer<T Class::*>
+{
+    typedef T Type;
+};
+
+} // namespace cborschema
+
+template<CborKey Key, auto Member, typename Schema = void>
+struct CborField
+{
+    typedef typename cborschema::MemberPointer<decltype(Member)>::Type Type;
+
+    static bool matches(const unsigned char *key, size_t length)
+    {
+        return length == Key.size && memcmp(key, Key.data, Key.size) == 0;
+    }
+
+    template<typename Object>
+    static size_t decode(const unsigned char *data, size_t size, Object &object)
+    {
+        return cborschema::FieldValue<Type, Schema>::decode(data, size, object.*Member);
+    }
+};
+
+template<typename T, typename... Fields>
+struct CborSchema
+{
+    typedef T Type;
+
+    // Decodes the map at data into result. Returns the size of the map, or
+    // 0 if the data is malformed or does not fit the schema; result may be
+    // changed partly then.
+    static size_t read(const char *data, size_t size, T &result)
+    {
+        return decode(reinterpret_cast<const unsigned char *>(data), size, result);
+    }
+
+    static size_t decode(const unsigned char *data, size_t size, T &result)
+    {
+        uint64_t count = 0;
+        size_t offset = cborschema::readHeader(data, size, CborItemMap, count);
+
+        if( offset == 0 )
+            return 0;
+
+        for(uint64_t i = 0; i < count; ++i)
+        {
+            uint64_t keyLength = 0;
+            size_t keyHeader = cborschema::readHeader(data + offset, size - offset, CborItemString, keyLength);
+            size_t length = 0;
+
+            if( keyHeader != 0 )
+            {
+                const unsigned char *key = data + offset + keyHeader;
+                size_t valueOffset = offset + keyHeader + keyLength;
+                bool matched = false;
+
+                // Expands to a chain of length and byte comparisons with
+                // the constant keys.
+                ((Fields::matches(key, keyLength) &&
+                  (matched = true, length = Fields::decode(data + valueOffset, size - valueOffset, result), true)) || ...);
+
+                if( matched )
+                {
+                    if( length == 0 )
+                        return 0;
+
+                    offset = valueOffset + length;
+                    continue;
+                }
+
+                offset = valueOffset;
+            }
+            else
+            {
+                // Not a string key: skipped with its value.
+                CborSkipInfo info;
+
+                length = cborSkipItem(data + offset, size - offset, info);
+
+                if( length == 0 )
+                    return 0;
+
+                offset += length;
+            }
+
+            CborSkipInfo info;
+
+            length = cborSkipItem(data + offset, size - offset, info);
+
+            if( length == 0 )
+                return 0;
+
+            offset += length;
+        }
+
+        return offset;
+    }
+};
+
+#endif // __cpp_nontype_template_args
+
+#endif // CBORSCHEMA_H
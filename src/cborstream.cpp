@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) Alex Nekipelov (alex@nekipelov.net)
+ * License: MIT
+ */
+
+#include "cborstream.h"
+
+#ifdef __cpp_impl_coroutine
+
+#include <algorithm>
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cborprivate.h"
+
+CborItemStream::CborItemStream(Handle handle)
+    : handle(handle)
+{
+}
+
+CborItemStream::CborItemStream(CborItemStream &&other) noexcept
+    : handle(other.handle)
+{
+    other.handle = Handle();
+}
+
+CborItemStream &CborItemStream::operator = (CborItemStream &&other) noexcept
+{
+    if( this != &other )
+    {
+        if( handle )
+            handle.destroy();
+
+        handle = other.handle;
+        other.handle = Handle();
+    }
+
+    return *this;
+}
+
+CborItemStream::~CborItemStream()
+{
+    if( handle )
+        handle.destroy();
+}
+
+bool CborItemStream::next()
+{
+    if( done() )
+        return false;
+
+    handle.resume();
+
+    promise_type &promise = handle.promise();
+
+    if( promise.exception )
+    {
+        std::exception_ptr exception = promise.exception;
+
+        promise.exception = std::exception_ptr();
+        std::rethrow_exception(exception);
+    }
+
+    return promise.state == Yielded;
+}
+
+CborValue &CborItemStream::value()
+{
+    return handle.promise().value;
+}
+
+bool CborItemStream::done() const
+{
+    return !handle || handle.done();
+}
+
+int CborItemStream::error() const
+{
+    return handle ? handle.promise().error : 0;
+}
+
+CborItemStream cborReadStream(int fd, size_t maxItemSize, size_t maxDepth)
+{
+    enum { ReadSize = 16 * 1024 };
+
+    CborDecoder decoder(maxDepth);
+    std::vector<char> buffer;
+    size_t begin = 0; // the first item which is not decoded yet
+    size_t end = 0;   // the end of the data
+    CborSkipState scan; // how far the incomplete item at begin was scanned
+
+    for(;;)
+    {
+        // Every complete item is decoded exactly from its boundaries.
+        while( begin != end )
+        {
+            const unsigned char *data = reinterpret_cast<const unsigned char *>(buffer.data());
+            CborSkipInfo info;
+            size_t length = cborSkipItem(data + begin, end - begin, info, scan);
+
+            if( length == 0 && info.truncated && end - begin < maxItemSize )
+                break;
+
+            CborValue item;
+
+            if( length == 0 || length > maxItemSize ||
+                decoder.read(buffer.data() + begin, length, item) == false )
+            {
+                co_await CborItemStream::Fail{EPROTO};
+                co_return;
+            }
+
+            begin += length;
+            scan = CborSkipState();
+            co_yield std::move(item);
+        }
+
+        // Keep only the incomplete item.
+        if( begin != 0 )
+        {
+            memmove(buffer.data(), buffer.data() + begin, end - begin);
+            end -= begin;
+            begin = 0;
+        }
+
+        if( buffer.size() - end < ReadSize )
+            buffer.resize(std::max<size_t>(buffer.size() * 2, end + ReadSize));
+
+        ssize_t count = ::read(fd, buffer.data() + end, buffer.size() - end);
+
+        if( count > 0 )
+        {
+            end += count;
+        }
+        else if( count == 0 )
+        {
+            if( end != 0 )
+                co_await CborItemStream::Fail{ECONNRESET};
+
+            co_return;
+        }
+        else if( errno == EAGAIN || errno == EWOULDBLOCK )
+        {
+            co_await CborItemStream::WaitReadable();
+        }
+        else if( errno != EINTR )
+        {
+            co_await CborItemStream::Fail{errno};
+            co_return;
+        }
+    }
+}
+
+#endif // __cpp_impl_coroutine
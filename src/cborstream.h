@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) Alex Nekipelov (alex@nekipelov.net)
+ * License: MIT
+ */
+
+#ifndef CBORSTREAM_H
+#define CBORSTREAM_H
+
+#include "cborreader.h"
+
+// Requires C++20 coroutines.
+#ifdef __cpp_impl_coroutine
+
+#include <coroutine>
+#include <exception>
+
+// Generator of the top-level items read from a file descriptor. The
+// coroutine reads until the descriptor would block and then suspends, so an
+// event loop resumes it when the descriptor is readable:
+//
+//   CborItemStream stream = cborReadStream(fd);
+//   ...
+//   // fd is readable
+//   while( stream.next() )
+//       handle(stream.value());
+//   if( stream.done() )
+//       close(fd);
+class CborItemStream {
+public:
+    struct promise_type;
+    typedef std::coroutine_handle<promise_type> Handle;
+
+    enum State {
+        Waiting,  // the descriptor has no data now
+        Yielded,  // value() is the next item
+        Finished, // end of the stream or an error
+    };
+
+    struct promise_type
+    {
+        CborItemStream get_return_object()
+        {
+            return CborItemStream(Handle::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() noexcept { return std::suspend_always(); }
+        std::suspend_always final_suspend() noexcept { return std::suspend_always(); }
+
+        std::suspend_always yield_value(CborValue &&item)
+        {
+            value = std::move(item);
+            state = Yielded;
+            return std::suspend_always();
+        }
+
+        void return_void() { state = Finished; }
+
+        void unhandled_exception()
+        {
+            exception = std::current_exception();
+            state = Finished;
+        }
+
+        State state = Waiting;
+        int error = 0;
+        CborValue value;
+        std::exception_ptr exception;
+    };
+
+    // Suspends the stream until the descriptor is readable.
+    struct WaitReadable
+    {
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(Handle handle) noexcept { handle.promise().state = Waiting; }
+        void await_resume() const noexcept {}
+    };
+
+    // Records the error of the stream without suspending it.
+    struct Fail
+    {
+        bool await_ready() const noexcept { return false; }
+
+        bool await_suspend(Handle handle) noexcept
+        {
+            handle.promise().error = error;
+            return false;
+        }
+
+        void await_resume() const noexcept {}
+
+        int error;
+    };
+
+    CborItemStream(CborItemStream &&other) noexcept;
+    CborItemStream &operator = (CborItemStream &&other) noexcept;
+    ~CborItemStream();
+
+    // Reads the next item. Returns false if the descriptor has no more data
+    // now or the stream is done. Rethrows exceptions of the coroutine.
+    bool next();
+
+    // The item read by the last successful next().
+    CborValue &value();
+
+    // True at the end of the data or after an error.
+    bool done() const;
+
+    // errno of the failed read, EPROTO for malformed data or an item larger
+    // than the limit, ECONNRESET for a stream which ends inside an item, 0
+    // otherwise.
+    int error() const;
+
+private:
+    explicit CborItemStream(Handle handle);
+
+    CborItemStream(const CborItemStream &);
+    CborItemStream &operator = (const CborItemStream &);
+
+    Handle handle;
+};
+
+// Reads the items from the non-blocking descriptor fd, which stays owned by
+// the caller. Item boundaries are found with the logic of cborItemSize before
+// an item is decoded; an item may not take more than maxItemSize bytes.
+CborItemStream cborReadStream(int fd, size_t maxItemSize = 64 * 1024 * 1024,
+                              size_t maxDepth = cborDefaultMaxDepth);
+
+#endif // __cpp_impl_coroutine
+
+#endif // CBORSTREAM_H
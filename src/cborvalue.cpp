@@ -4,21 +4,31 @@
  */
 
 #include <limits>
+#include <ostream>
+#include <unordered_set>
+
+#if __cplusplus >= 201703L
+#include <charconv>
+#endif
+
+#include <stdio.h>
+#include <string.h>
 
-#include <boost/lexical_cast.hpp>
 #include <boost/optional.hpp>
 
 #include "cborvalue.h"
+#include "cborreader.h"
+#include "cborprivate.h"
 
 struct ValueSizeVisitor : public boost::static_visitor<size_t>
 {
-    size_t operator()(const std::vector<CborValue> &arr) const
+    size_t operator()(const CborShared< std::vector<CborValue> > &arr) const
     {
-        return arr.size();
+        return arr.get().size();
     }
-    size_t operator()(const std::map<CborValue, CborValue> &map) const
+    size_t operator()(const CborShared< std::map<CborValue, CborValue> > &map) const
     {
-        return map.size();
+        return map.get().size();
     }
 
     template<typename T>
@@ -29,65 +39,16 @@ struct ValueSizeVisitor : public boost::static_visitor<size_t>
     }
 };
 
-struct ValueHasMemberVisitor : public boost::static_visitor<bool>
-{
-    ValueHasMemberVisitor(const CborValue &key)
-        : key(key)
-    {}
-
-    bool operator()(const std::map<CborValue, CborValue> &map) const
-    {
-        return map.find(key) != map.end();
-    }
-
-    template<typename T>
-    bool operator()(const T &) const
-    {
-        //return false;
-        throw std::runtime_error( "CborValue: invalid type");
-    }
-
-    const CborValue &key;
-};
-
-struct ValueGetMemberVisitor : public boost::static_visitor<CborValue>
-{
-    ValueGetMemberVisitor(const CborValue &key)
-        : key(key)
-    {}
-
-    CborValue operator()(const std::map<CborValue, CborValue> &map) const
-    {
-        std::map<CborValue, CborValue>::const_iterator it = map.find(key);
-
-        if( it != map.end() )
-            return it->second;
-//        else
-//            return CborValue::null();
-
-        throw std::runtime_error( "CborValue: invalid type");
-    }
-
-    template<typename T>
-    CborValue operator()(const T &) const
-    {
-        //return CborValue::null();
-        throw std::runtime_error( "CborValue: invalid type");
-    }
-
-    const CborValue &key;
-};
-
 struct ValueGetArrayItemVisitor : public boost::static_visitor<CborValue>
 {
     ValueGetArrayItemVisitor(size_t index)
         : index(index)
     {}
 
-    CborValue operator()(const std::vector<CborValue> &arr) const
+    CborValue operator()(const CborShared< std::vector<CborValue> > &arr) const
     {
-        if( index < arr.size() )
-            return arr[index];
+        if( index < arr.get().size() )
+            return arr.get()[index];
         else
             return CborValue::null();
     }
@@ -170,27 +131,47 @@ CborValue::CborValue(double d)
 }
 
 CborValue::CborValue(const std::string &s)
-    : value(s)
+    : value(SharedString(s))
 {
 }
 
 CborValue::CborValue(const std::vector<char> &bs)
-    : value(bs)
+    : value(SharedByteString(bs))
 {
 }
 
 CborValue::CborValue(const char *s)
-    : value(std::string(s))
+    : value(SharedString(std::string(s)))
 {
 }
 
 CborValue::CborValue(const std::vector<CborValue> &vec)
-    : value(vec)
+    : value(SharedArray(vec))
 {
 }
 
 CborValue::CborValue(const std::map<CborValue, CborValue> &map)
-    : value(map)
+    : value(SharedMap(map))
+{
+}
+
+CborValue::CborValue(std::string &&s)
+    : value(SharedString(std::move(s)))
+{
+}
+
+CborValue::CborValue(std::vector<char> &&bs)
+    : value(SharedByteString(std::move(bs)))
+{
+}
+
+CborValue::CborValue(std::vector<CborValue> &&vec)
+    : value(SharedArray(std::move(vec)))
+{
+}
+
+CborValue::CborValue(std::map<CborValue, CborValue> &&map)
+    : value(SharedMap(std::move(map)))
 {
 }
 
@@ -199,6 +180,33 @@ CborValue::CborValue(const BigInteger &bigint)
 {
 }
 
+CborValue::CborValue(const DateTime &dateTime)
+    : value(dateTime)
+{
+    if( cborIsValidDateTime(dateTime) == false )
+        throw std::runtime_error( "CborValue: invalid date/time");
+}
+
+CborValue::CborValue(const EpochTime &epochTime)
+    : value(epochTime)
+{
+}
+
+CborValue::CborValue(const DecimalFraction &decimalFraction)
+    : value(decimalFraction)
+{
+}
+
+CborValue::CborValue(const BigFloat &bigFloat)
+    : value(bigFloat)
+{
+}
+
+CborValue::CborValue(const Raw &raw)
+    : value(SharedRaw(raw))
+{
+}
+
 CborValue CborValue::null()
 {
     return CborValue(NullTag());
@@ -209,6 +217,25 @@ CborValue CborValue::undefiend()
     return CborValue(UndefinedTag());
 }
 
+CborValue CborValue::raw(const std::vector<char> &encoded)
+{
+    if( encoded.empty() || cborItemSize(encoded.data(), encoded.size()) != encoded.size() )
+        throw std::runtime_error( "CborValue: invalid raw data");
+
+    Raw raw = {encoded};
+    return CborValue(raw);
+}
+
+CborValue CborValue::dateTime(const std::string &text)
+{
+    DateTime result;
+
+    if( cborParseDateTime(text.data(), text.size(), result) == false )
+        throw std::runtime_error( "CborValue: invalid date/time");
+
+    return CborValue(result);
+}
+
 bool CborValue::isNull() const
 {
     return type() == NullType;
@@ -264,6 +291,31 @@ bool CborValue::isBigInteger() const
     return type() == BigIntegerType;
 }
 
+bool CborValue::isRaw() const
+{
+    return type() == RawType;
+}
+
+bool CborValue::isDateTime() const
+{
+    return type() == DateTimeType;
+}
+
+bool CborValue::isEpochTime() const
+{
+    return type() == EpochTimeType;
+}
+
+bool CborValue::isDecimalFraction() const
+{
+    return type() == DecimalFractionType;
+}
+
+bool CborValue::isBigFloat() const
+{
+    return type() == BigFloatType;
+}
+
 bool CborValue::toBool() const
 {
     return castTo<bool>();
@@ -279,6 +331,25 @@ uint64_t CborValue::toNegativeInteger() const
     return castTo<NegativeInteger>().value;
 }
 
+boost::optional<int64_t> CborValue::tryToInt64() const
+{
+    const uint64_t max = static_cast<uint64_t>(std::numeric_limits<int64_t>::max());
+
+    if( const PositiveInteger *positive = getIf<PositiveInteger>() )
+    {
+        if( positive->value <= max )
+            return static_cast<int64_t>(positive->value);
+    }
+    else if( const NegativeInteger *negative = getIf<NegativeInteger>() )
+    {
+        // Stored as the absolute value, 0 meaning -2^64.
+        if( negative->value != 0 && negative->value - 1 <= max )
+            return -1 - static_cast<int64_t>(negative->value - 1);
+    }
+
+    return boost::none;
+}
+
 double CborValue::toDouble() const
 {
     return castTo<double>();
@@ -309,159 +380,432 @@ CborValue::BigInteger CborValue::toBigInteger() const
     return castTo<BigInteger>();
 }
 
+std::vector<char> CborValue::toRaw() const
+{
+    return castTo<Raw>().data;
+}
+
+CborValue::DateTime CborValue::toDateTime() const
+{
+    return castTo<DateTime>();
+}
+
+CborValue::EpochTime CborValue::toEpochTime() const
+{
+    return castTo<EpochTime>();
+}
+
+CborValue::DecimalFraction CborValue::toDecimalFraction() const
+{
+    return castTo<DecimalFraction>();
+}
+
+CborValue::BigFloat CborValue::toBigFloat() const
+{
+    return castTo<BigFloat>();
+}
+
 CborValue::Type CborValue::type() const
 {
     return static_cast<CborValue::Type>(value.which());
 }
 
-std::string CborValue::inspect() const
+namespace {
+
+// Writes diagnostic notation into a string. With a stream the text is passed
+// on in chunks, so the string stays small.
+class DiagnosticWriter
 {
-    if( isNull() )
+public:
+    DiagnosticWriter(std::string &text, std::ostream *stream, size_t maxDepth, size_t maxLength)
+        : out(text), stream(stream), start(text.size()), flushed(0)
+        , maxDepth(maxDepth), maxLength(maxLength), truncated(false)
+    {}
+
+    void write(const CborValue &value, size_t depth);
+
+    // Cuts the text at maxLength and writes out the rest.
+    void finish()
     {
-        static std::string null = "(null)";
-        return null;
+        if( length() > maxLength )
+        {
+            out.truncate(start + maxLength - flushed);
+            out.append("...", 3);
+        }
+
+        flush();
     }
-    else if( isUndefined() )
+
+private:
+    enum { ChunkSize = 4096 };
+
+    size_t length() const
     {
-        static std::string undefined = "(undefined)";
-        return undefined;
+        return flushed + out.size() - start;
     }
-    else if( isBool() )
+
+    // Bytes left before the cut.
+    size_t budget() const
     {
-        return boost::lexical_cast<std::string>(toBool());
+        size_t used = length();
+        return used < maxLength ? maxLength - used : 0;
     }
-    else if( isPositiveInteger() )
+
+    void flush()
     {
-        return boost::lexical_cast<std::string>(toPositiveInteger());
+        if( stream != 0 )
+        {
+            stream->write(out.data() + start, out.size() - start);
+            flushed += out.size() - start;
+            out.truncate(start);
+        }
     }
-    else if( isNegativeInteger() )
-    {
-        std::string result = "-";
-        const char specialValue[] = "18446744073709551616"; // 0x10000000000000000
-        uint64_t value = toNegativeInteger();
-
-        if( value == 0 )
-            result += specialValue;
-        else
-            result += boost::lexical_cast<std::string>(value);
 
-        return result;
-    }
-    else if( isDouble() )
+    void writeSigned(int64_t value)
     {
-        return boost::lexical_cast<std::string>(toDouble());
+        if( value < 0 )
+            out.put('-');
+
+        uint64_t magnitude = value < 0 ? 0 - static_cast<uint64_t>(value) : value;
+        out.commit(cborFormatUnsigned(magnitude, out.reserve(cborMaxNumberSize)));
     }
-    else if( isString() )
+
+    void writeDouble(double value)
     {
-        return toString();
+        if( value != value )
+            out.append("NaN", 3);
+        else if( isinf(value) )
+            value < 0 ? out.append("-Infinity", 9) : out.append("Infinity", 8);
+        else
+            out.commit(cborFormatDouble(value, out.reserve(cborMaxNumberSize)));
     }
-    else if( isByteString() )
+
+    // h'...', only as many bytes as the budget lets through.
+    void writeBytes(const char *data, size_t size)
     {
-        std::vector<char> byteString = toByteString();
-        std::string result = "(0x";
+        static const char hex[] = "0123456789abcdef";
+
+        size = std::min(size, budget() / 2 + 1);
+
+        char *text = out.reserve(size * 2 + 3);
+        char *p = text;
 
-        static const char hex[16] = {'0', '1', '2', '3', '4', '5', '6', '7', '8', '9',
-                                     'A', 'B', 'C', 'D', 'E', 'F'};
+        *p++ = 'h';
+        *p++ = '\'';
 
-        for(size_t i = 0; i < byteString.size(); ++i)
+        for(size_t i = 0; i < size; ++i)
         {
-            unsigned char c = static_cast<unsigned char>(byteString[i]);
+            unsigned char c = static_cast<unsigned char>(data[i]);
 
-            result += hex[c / sizeof(hex)];
-            result += hex[c % sizeof(hex)];
+            *p++ = hex[c >> 4];
+            *p++ = hex[c & 0xf];
         }
 
-        result += ')';
-        return result;
+        *p++ = '\'';
+        out.commit(p - text);
+    }
+
+    void writeTag(int tag)
+    {
+        out.commit(cborFormatUnsigned(tag, out.reserve(cborMaxNumberSize)));
+        out.put('(');
     }
-    else if( isArray() )
+
+    CborOutputBuffer<std::string> out;
+    std::ostream *stream;
+    size_t start;
+    size_t flushed;
+    size_t maxDepth;
+    size_t maxLength;
+    bool truncated;
+};
+
+void DiagnosticWriter::write(const CborValue &value, size_t depth)
+{
+    if( budget() == 0 )
     {
-        std::vector<CborValue> values = toArray();
-        std::string result = "[";
+        truncated = true;
+        return;
+    }
 
-        if( values.empty() == false )
-        {
-            for(size_t i = 0; i < values.size(); ++i)
+    switch( value.type() )
+    {
+        case CborValue::NullType:
+            out.append("null", 4);
+            break;
+        case CborValue::UndefinedType:
+            out.append("undefined", 9);
+            break;
+        case CborValue::BoolType:
+            value.toBool() ? out.append("true", 4) : out.append("false", 5);
+            break;
+        case CborValue::PositiveIntegerType:
+            out.commit(cborFormatUnsigned(value.toPositiveInteger(), out.reserve(cborMaxNumberSize)));
+            break;
+        case CborValue::NegativeIntegerType:
+            if( value.toNegativeInteger() == 0 )
+            {
+                static const char specialValue[] = "-18446744073709551616"; // -0x10000000000000000
+                out.append(specialValue, sizeof(specialValue) - 1);
+            }
+            else
             {
-                result += values[i].inspect();
-                result += ", ";
+                out.put('-');
+                out.commit(cborFormatUnsigned(value.toNegativeInteger(), out.reserve(cborMaxNumberSize)));
             }
+            break;
+        case CborValue::DoubleType:
+            writeDouble(value.toDouble());
+            break;
+        case CborValue::StringType:
+        {
+            // Escapes take at most 6 bytes, the rest of a long string is
+            // not looked at.
+            const std::string &text = *value.getIf<std::string>();
+            size_t size = std::min(text.size(), budget());
 
-            result.resize(result.size() - 1);
-            result[result.size() - 1] = ']';
+            cborWriteJsonString(out, reinterpret_cast<const unsigned char *>(text.data()), size);
+            break;
         }
-        else
+        case CborValue::ByteStringType:
         {
-            result += ']';
+            const std::vector<char> &bytes = *value.getIf< std::vector<char> >();
+
+            writeBytes(bytes.data(), bytes.size());
+            break;
         }
+        case CborValue::ArrayType:
+        {
+            const std::vector<CborValue> &items = *value.getIf< std::vector<CborValue> >();
 
-        return result;
-    }
-    else if( isMap() )
-    {
-        std::map<CborValue, CborValue> values = toMap();
-        std::string result = "{";
+            if( !items.empty() && depth >= maxDepth )
+            {
+                out.append("[...]", 5);
+                break;
+            }
+
+            out.put('[');
 
-        if( values.empty() == false )
+            for(size_t i = 0; i < items.size() && !truncated; ++i)
+            {
+                if( i != 0 )
+                    out.append(", ", 2);
+
+                write(items[i], depth + 1);
+            }
+
+            out.put(']');
+            break;
+        }
+        case CborValue::MapType:
         {
-            std::map<CborValue, CborValue>::iterator it = values.begin();
-            std::map<CborValue, CborValue>::iterator end = values.end();
+            const std::map<CborValue, CborValue> &members = *value.getIf< std::map<CborValue, CborValue> >();
+
+            if( !members.empty() && depth >= maxDepth )
+            {
+                out.append("{...}", 5);
+                break;
+            }
+
+            out.put('{');
 
-            for(; it != end; ++it)
+            std::map<CborValue, CborValue>::const_iterator it = members.begin();
+
+            for(; it != members.end() && !truncated; ++it)
             {
-                result += it->first.inspect();
-                result += ": ";
-                result += it->second.inspect();
-                result += ", ";
+                if( it != members.begin() )
+                    out.append(", ", 2);
+
+                write(it->first, depth + 1);
+                out.append(": ", 2);
+                write(it->second, depth + 1);
             }
 
-            result.resize(result.size() - 1);
-            result[result.size() - 1] = '}';
+            out.put('}');
+            break;
         }
-        else
+        case CborValue::BigIntegerType:
+        {
+            const CborValue::BigInteger &bigInteger = *value.getIf<CborValue::BigInteger>();
+
+            writeTag(bigInteger.positive ? PositiveBignum : NegativeBignum);
+            writeBytes(bigInteger.bigint.data(), bigInteger.bigint.size());
+            out.put(')');
+            break;
+        }
+        case CborValue::RawType:
+        {
+            // The encoded item as it is, marked by a comment.
+            const CborValue::Raw &raw = *value.getIf<CborValue::Raw>();
+
+            out.append("/raw/ ", 6);
+            writeBytes(raw.data.data(), raw.data.size());
+            break;
+        }
+        case CborValue::DateTimeType:
         {
-            result += '}';
+            char text[cborMaxDateTimeSize];
+            size_t size = cborFormatDateTime(*value.getIf<CborValue::DateTime>(), text);
+
+            writeTag(TextBasedDateTime);
+            out.put('"');
+            out.append(text, size);
+            out.append("\")", 2);
+            break;
         }
+        case CborValue::EpochTimeType:
+        {
+            const CborValue::EpochTime &epochTime = *value.getIf<CborValue::EpochTime>();
 
-        return result;
+            writeTag(EpochBasedDateTime);
+
+            if( epochTime.integral )
+                writeSigned(epochTime.seconds);
+            else
+                writeDouble(epochTime.realSeconds);
+
+            out.put(')');
+            break;
+        }
+        case CborValue::DecimalFractionType:
+        case CborValue::BigFloatType:
+        {
+            // [exponent, mantissa] under tag 4 or 5.
+            bool decimal = value.isDecimalFraction();
+            const CborValue::DecimalFraction *fraction = value.getIf<CborValue::DecimalFraction>();
+            const CborValue::BigFloat *bigFloat = value.getIf<CborValue::BigFloat>();
+
+            writeTag(decimal ? DecimalFraction : BigFloat);
+            out.put('[');
+            writeSigned(decimal ? fraction->exponent : bigFloat->exponent);
+            out.append(", ", 2);
+            writeSigned(decimal ? fraction->mantissa : bigFloat->mantissa);
+            out.append("])", 2);
+            break;
+        }
     }
-    else if( isBigInteger() )
-    {
-        BigInteger bigInteger = toBigInteger();
-        std::string result;
 
-        if( bigInteger.positive )
-            result = "(big integer: 0x";
-        else
-            result = "(negative big integer: 0x";
+    if( stream != 0 && out.size() - start >= ChunkSize && length() <= maxLength )
+        flush();
+}
 
-        static const char hex[16] = {'0', '1', '2', '3', '4', '5', '6', '7', '8', '9',
-                                     'A', 'B', 'C', 'D', 'E', 'F'};
+} // namespace
 
-        if( bigInteger.bigint.empty() == false )
+void CborValue::writeDiagnostic(std::ostream &stream, size_t maxDepth, size_t maxLength) const
+{
+    std::string buffer;
+    DiagnosticWriter writer(buffer, &stream, maxDepth, maxLength);
+
+    writer.write(*this, 0);
+    writer.finish();
+}
+
+void CborValue::writeDiagnostic(std::string &text, size_t maxDepth, size_t maxLength) const
+{
+    DiagnosticWriter writer(text, 0, maxDepth, maxLength);
+
+    writer.write(*this, 0);
+    writer.finish();
+}
+
+std::string CborValue::inspect() const
+{
+    std::string result;
+
+    writeDiagnostic(result);
+    return result;
+}
+
+// Whether a payload is met for the first time by memoryUsage(). A payload
+// which is not shared can not be met again and is not remembered; a value
+// left by a move has none.
+template<typename T>
+static bool firstVisit(const CborShared<T> &shared, std::unordered_set<const void *> &seen)
+{
+    return shared.unique() || (shared.identity() != 0 && seen.insert(shared.identity()).second);
+}
+
+const CborValue &cborSharedEmptyArray()
+{
+    static const CborValue value = CborValue(std::vector<CborValue>());
+    return value;
+}
+
+const CborValue &cborSharedEmptyMap()
+{
+    static const CborValue value = CborValue(std::map<CborValue, CborValue>());
+    return value;
+}
+
+size_t CborValue::memoryUsage() const
+{
+    // The tree is walked with an explicit stack, it may be nested deeply.
+    std::unordered_set<const void *> seen;
+    std::vector<const CborValue *> stack(1, this);
+    size_t usage = 0;
+
+    seen.insert(boost::get<SharedArray>(cborSharedEmptyArray().value).identity());
+    seen.insert(boost::get<SharedMap>(cborSharedEmptyMap().value).identity());
+
+    while( stack.empty() == false )
+    {
+        const Variant &item = stack.back()->value;
+        stack.pop_back();
+
+        if( const SharedString *string = boost::get<SharedString>(&item) )
+        {
+            if( firstVisit(*string, seen) )
+                usage += SharedString::allocationSize() + cborHeapSize(string->get());
+        }
+        else if( const SharedByteString *bytes = boost::get<SharedByteString>(&item) )
+        {
+            if( firstVisit(*bytes, seen) )
+                usage += SharedByteString::allocationSize() + cborHeapSize(bytes->get());
+        }
+        else if( const SharedArray *array = boost::get<SharedArray>(&item) )
         {
-            for(size_t i = 0; i < bigInteger.bigint.size(); ++i)
+            if( firstVisit(*array, seen) )
             {
-                unsigned char c = static_cast<unsigned char >(bigInteger.bigint[i]);
+                const std::vector<CborValue> &items = array->get();
+
+                usage += SharedArray::allocationSize() + cborHeapSize(items);
 
-                result += hex[c / sizeof(hex)];
-                result += hex[c % sizeof(hex)];
+                for(size_t i = 0; i < items.size(); ++i)
+                {
+                    if( items[i].type() >= StringType )
+                        stack.push_back(&items[i]);
+                }
             }
+        }
+        else if( const SharedMap *map = boost::get<SharedMap>(&item) )
+        {
+            if( firstVisit(*map, seen) )
+            {
+                const std::map<CborValue, CborValue> &members = map->get();
+                std::map<CborValue, CborValue>::const_iterator it = members.begin();
 
-            result.resize(result.size() - 1);
-            result[result.size() - 1] = ')';
+                usage += SharedMap::allocationSize() + members.size() * cborMapNodeSize;
+
+                for(; it != members.end(); ++it)
+                {
+                    stack.push_back(&it->first);
+                    stack.push_back(&it->second);
+                }
+            }
         }
-        else
+        else if( const BigInteger *bigInteger = boost::get<BigInteger>(&item) )
         {
-            result += ')';
+            if( bigInteger->bigint.size() > CborSmallBytes::InlineCapacity )
+                usage += bigInteger->bigint.size();
+        }
+        else if( const SharedRaw *raw = boost::get<SharedRaw>(&item) )
+        {
+            if( firstVisit(*raw, seen) )
+                usage += SharedRaw::allocationSize() + cborHeapSize(raw->get().data);
         }
-
-        return result;
     }
 
-    assert(false);
-    std::string invalidType = "(invalid type)";
-    return invalidType;
+    return usage;
 }
 
 size_t CborValue::size() const
@@ -476,12 +820,36 @@ bool CborValue::isEmpty() const
 
 bool CborValue::hasMember(const CborValue &key) const
 {
-    return boost::apply_visitor(ValueHasMemberVisitor(key), value);
+    if( isMap() == false )
+        throw std::runtime_error( "CborValue: invalid type");
+
+    return find(key) != 0;
 }
 
 CborValue CborValue::member(const CborValue &key) const
 {
-    return boost::apply_visitor(ValueGetMemberVisitor(key), value);
+    if( isMap() == false )
+        throw std::runtime_error( "CborValue: invalid type");
+
+    if( const CborValue *item = find(key) )
+        return *item;
+
+    throw std::runtime_error( "CborValue: no such member");
+}
+
+const CborValue *CborValue::find(const CborValue &key) const
+{
+    const std::map<CborValue, CborValue> *map = getIf< std::map<CborValue, CborValue> >();
+
+    if( map == 0 )
+        return 0;
+
+    std::map<CborValue, CborValue>::const_iterator it = map->find(key);
+
+    if( it == map->end() )
+        return 0;
+
+    return &it->second;
 }
 
 CborValue CborValue::at(size_t arrayIndex) const
@@ -489,6 +857,254 @@ CborValue CborValue::at(size_t arrayIndex) const
     return boost::apply_visitor(ValueGetArrayItemVisitor(arrayIndex), value);
 }
 
+CborValue::ArrayRange CborValue::arrayItems() const
+{
+    const std::vector<CborValue> *arr = getIf< std::vector<CborValue> >();
+
+    if( arr == 0 )
+        throw std::runtime_error( "CborValue: invalid type");
+
+    return ArrayRange(*this, arr->begin(), arr->end());
+}
+
+CborValue::MapRange CborValue::mapItems() const
+{
+    const std::map<CborValue, CborValue> *map = getIf< std::map<CborValue, CborValue> >();
+
+    if( map == 0 )
+        throw std::runtime_error( "CborValue: invalid type");
+
+    return MapRange(*this, map->begin(), map->end());
+}
+
+static inline uint64_t hashMix(uint64_t a, uint64_t b)
+{
+    unsigned __int128 product = static_cast<unsigned __int128>(a) * b;
+
+    return static_cast<uint64_t>(product) ^ static_cast<uint64_t>(product >> 64);
+}
+
+static inline uint64_t hashLoad(const unsigned char *data)
+{
+    uint64_t word;
+
+    memcpy(&word, data, sizeof(word));
+    return word;
+}
+
+static const uint64_t hashKey0 = 0xa0761d6478bd642fULL;
+static const uint64_t hashKey1 = 0xe7037ed1a0b428dbULL;
+static const uint64_t hashKey2 = 0x8ebc6af09c88c6e3ULL;
+
+uint64_t cborHashBytes(const void *data, size_t size, uint64_t seed)
+{
+    const unsigned char *ptr = static_cast<const unsigned char *>(data);
+    uint64_t result = hashMix(seed ^ hashKey0, size ^ hashKey1);
+
+    // Two words per step, the products are independent of each other.
+    for(; size >= 16; size -= 16, ptr += 16)
+        result = hashMix(hashLoad(ptr) ^ hashKey1, hashLoad(ptr + 8) ^ result);
+
+    if( size >= 8 )
+    {
+        result = hashMix(hashLoad(ptr) ^ hashKey2, result ^ hashKey1);
+        size -= 8;
+        ptr += 8;
+    }
+
+    if( size != 0 )
+    {
+        uint64_t tail = 0;
+
+        memcpy(&tail, ptr, size);
+        result = hashMix(tail ^ hashKey2, result ^ hashKey0);
+    }
+
+    return hashMix(result ^ hashKey1, result ^ hashKey2);
+}
+
+size_t CborValue::hash(size_t seed) const
+{
+    Type valueType = type();
+    uint64_t result = hashMix(seed ^ hashKey0, valueType + hashKey2);
+
+    switch(valueType)
+    {
+    case NullType:
+    case UndefinedType:
+        return result;
+    case BoolType:
+        return hashMix(result, boost::get<bool>(value) + hashKey1);
+    case PositiveIntegerType:
+        return hashMix(result, boost::get<PositiveInteger>(value).value ^ hashKey1);
+    case NegativeIntegerType:
+        return hashMix(result, boost::get<NegativeInteger>(value).value ^ hashKey1);
+    case DoubleType: {
+        // 0.0 and -0.0 are equal, so they must have the same hash.
+        double d = boost::get<double>(value) + 0.0;
+        uint64_t bits;
+
+        memcpy(&bits, &d, sizeof(bits));
+        return hashMix(result, bits ^ hashKey1);
+    }
+    case StringType: {
+        const std::string &s = boost::get<SharedString>(value).get();
+        return cborHashBytes(s.data(), s.size(), result);
+    }
+    case ByteStringType: {
+        const std::vector<char> &bs = boost::get<SharedByteString>(value).get();
+        return cborHashBytes(bs.data(), bs.size(), result);
+    }
+    case BigIntegerType: {
+        const BigInteger &bigInteger = boost::get<BigInteger>(value);
+        return cborHashBytes(bigInteger.bigint.data(), bigInteger.bigint.size(),
+                             result + bigInteger.positive);
+    }
+    case RawType: {
+        const std::vector<char> &raw = boost::get<SharedRaw>(value).get().data;
+        return cborHashBytes(raw.data(), raw.size(), result);
+    }
+    case DateTimeType: {
+        const DateTime &dateTime = boost::get<DateTime>(value);
+        uint64_t rest = dateTime.nanoseconds | static_cast<uint64_t>(static_cast<uint16_t>(dateTime.utcOffset)) << 32;
+
+        return hashMix(hashMix(result, dateTime.seconds ^ hashKey1), rest ^ hashKey2);
+    }
+    case EpochTimeType: {
+        const EpochTime &epochTime = boost::get<EpochTime>(value);
+        uint64_t bits = epochTime.seconds;
+
+        if( !epochTime.integral )
+        {
+            double d = epochTime.realSeconds + 0.0;
+            memcpy(&bits, &d, sizeof(bits));
+        }
+
+        return hashMix(result + epochTime.integral, bits ^ hashKey1);
+    }
+    case DecimalFractionType: {
+        const DecimalFraction &fraction = boost::get<DecimalFraction>(value);
+        return hashMix(hashMix(result, fraction.exponent ^ hashKey1), fraction.mantissa ^ hashKey2);
+    }
+    case BigFloatType: {
+        const BigFloat &bigFloat = boost::get<BigFloat>(value);
+        return hashMix(hashMix(result, bigFloat.exponent ^ hashKey1), bigFloat.mantissa ^ hashKey2);
+    }
+    case ArrayType:
+    case MapType:
+        break;
+    }
+
+    bool cacheable = seed == defaultHashSeed;
+
+    if( valueType == ArrayType )
+    {
+        const SharedArray &shared = boost::get<SharedArray>(value);
+
+        if( cacheable && shared.cachedHash() != 0 )
+            return shared.cachedHash();
+
+        const std::vector<CborValue> &arr = shared.get();
+
+        for(size_t i = 0; i < arr.size(); ++i)
+            result = hashMix(result ^ arr[i].hash(seed), hashKey1);
+    }
+    else
+    {
+        const SharedMap &shared = boost::get<SharedMap>(value);
+
+        if( cacheable && shared.cachedHash() != 0 )
+            return shared.cachedHash();
+
+        const std::map<CborValue, CborValue> &map = shared.get();
+        std::map<CborValue, CborValue>::const_iterator it = map.begin();
+        std::map<CborValue, CborValue>::const_iterator end = map.end();
+
+        for(; it != end; ++it)
+        {
+            result = hashMix(result ^ it->first.hash(seed), hashKey1);
+            result = hashMix(result ^ it->second.hash(seed), hashKey2);
+        }
+    }
+
+    if( cacheable )
+    {
+        // 0 marks a hash which is not computed yet.
+        if( result == 0 )
+            result = 1;
+
+        if( valueType == ArrayType )
+            boost::get<SharedArray>(value).cacheHash(result);
+        else
+            boost::get<SharedMap>(value).cacheHash(result);
+    }
+
+    return result;
+}
+
+void CborValue::append(const CborValue &item)
+{
+    SharedArray *arr = boost::get<SharedArray>(&value);
+
+    if( arr == 0 )
+        throw std::runtime_error( "CborValue: invalid type");
+
+    // The item is copied before detaching, so appending a value to itself
+    // does not make its payload contain itself.
+    CborValue copy(item);
+    arr->mutate().push_back(std::move(copy));
+}
+
+void CborValue::setAt(size_t arrayIndex, const CborValue &item)
+{
+    SharedArray *arr = boost::get<SharedArray>(&value);
+
+    if( arr == 0 )
+        throw std::runtime_error( "CborValue: invalid type");
+
+    if( arrayIndex >= arr->get().size() )
+        throw std::out_of_range( "CborValue: invalid index");
+
+    CborValue copy(item);
+    arr->mutate()[arrayIndex] = std::move(copy);
+}
+
+void CborValue::resize(size_t size)
+{
+    SharedArray *arr = boost::get<SharedArray>(&value);
+
+    if( arr == 0 )
+        throw std::runtime_error( "CborValue: invalid type");
+
+    if( arr->get().size() != size )
+        arr->mutate().resize(size);
+}
+
+void CborValue::setMember(const CborValue &key, const CborValue &item)
+{
+    SharedMap *map = boost::get<SharedMap>(&value);
+
+    if( map == 0 )
+        throw std::runtime_error( "CborValue: invalid type");
+
+    CborValue copy(item);
+    map->mutate()[key] = std::move(copy);
+}
+
+bool CborValue::removeMember(const CborValue &key)
+{
+    SharedMap *map = boost::get<SharedMap>(&value);
+
+    if( map == 0 )
+        throw std::runtime_error( "CborValue: invalid type");
+
+    if( map->get().find(key) == map->get().end() )
+        return false;
+
+    map->mutate().erase(key);
+    return true;
+}
+
 bool operator < (const CborValue &lhs, const CborValue &rhs)
 {
     return lhs.value < rhs.value;
@@ -496,6 +1112,26 @@ bool operator < (const CborValue &lhs, const CborValue &rhs)
 
 bool operator == (const CborValue &lhs, const CborValue &rhs)
 {
+    // Containers with known and different hashes can not be equal.
+    size_t lhsHash = 0;
+    size_t rhsHash = 0;
+
+    if( const CborValue::SharedArray *arr = boost::get<CborValue::SharedArray>(&lhs.value) )
+        lhsHash = arr->cachedHash();
+    else if( const CborValue::SharedMap *map = boost::get<CborValue::SharedMap>(&lhs.value) )
+        lhsHash = map->cachedHash();
+
+    if( lhsHash != 0 )
+    {
+        if( const CborValue::SharedArray *arr = boost::get<CborValue::SharedArray>(&rhs.value) )
+            rhsHash = arr->cachedHash();
+        else if( const CborValue::SharedMap *map = boost::get<CborValue::SharedMap>(&rhs.value) )
+            rhsHash = map->cachedHash();
+
+        if( rhsHash != 0 && lhsHash != rhsHash )
+            return false;
+    }
+
     return lhs.value == rhs.value;
 }
 
@@ -535,10 +1171,10 @@ CborValue::Iterator::Iterator(const CborValue &value)
     switch(value.type())
     {
     case CborValue::ArrayType:
-        pimpl.reset(new IteratorImpl(boost::get< std::vector<CborValue> >(value.value)));
+        pimpl.reset(new IteratorImpl(boost::get<SharedArray>(value.value).get()));
         break;
     case CborValue::MapType:
-        pimpl.reset(new IteratorImpl(boost::get< std::map<CborValue, CborValue> >(value.value)));
+        pimpl.reset(new IteratorImpl(boost::get<SharedMap>(value.value).get()));
         break;
     default:
         break;
@@ -699,3 +1335,251 @@ CborValue CborValue::Iterator::value() const
         return CborValue::null();
     }
 }
+
+// Days since 1970-01-01 of a date in the proleptic Gregorian calendar.
+static int64_t daysFromCivil(int64_t year, unsigned int month, unsigned int day)
+{
+    year -= month <= 2;
+
+    int64_t era = (year >= 0 ? year : year - 399) / 400;
+    unsigned int yearOfEra = static_cast<unsigned int>(year - era * 400);
+    unsigned int dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    unsigned int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+
+    return era * 146097 + static_cast<int64_t>(dayOfEra) - 719468;
+}
+
+static void civilFromDays(int64_t days, int64_t &year, unsigned int &month, unsigned int &day)
+{
+    days += 719468;
+
+    int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+    unsigned int dayOfEra = static_cast<unsigned int>(days - era * 146097);
+    unsigned int yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    unsigned int dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    unsigned int shiftedMonth = (5 * dayOfYear + 2) / 153;
+
+    day = dayOfYear - (153 * shiftedMonth + 2) / 5 + 1;
+    month = shiftedMonth < 10 ? shiftedMonth + 3 : shiftedMonth - 9;
+    year = static_cast<int64_t>(yearOfEra) + era * 400 + (month <= 2);
+}
+
+// Value of two decimal digits, -1 if they are not digits.
+static inline int parseTwoDigits(const char *text)
+{
+    unsigned int high = static_cast<unsigned char>(text[0]) - '0';
+    unsigned int low = static_cast<unsigned char>(text[1]) - '0';
+
+    if( high > 9 || low > 9 )
+        return -1;
+
+    return high * 10 + low;
+}
+
+bool cborParseDateTime(const char *text, size_t size, CborValue::DateTime &result)
+{
+    // YYYY-MM-DDTHH:MM:SS[.fraction](Z|+HH:MM|-HH:MM), every field has a
+    // fixed position except the fraction.
+    if( size < 20 || text[4] != '-' || text[7] != '-' || text[13] != ':' || text[16] != ':' ||
+        (text[10] != 'T' && text[10] != 't') )
+    {
+        return false;
+    }
+
+    int century = parseTwoDigits(text);
+    int yearOfCentury = parseTwoDigits(text + 2);
+    int month = parseTwoDigits(text + 5);
+    int day = parseTwoDigits(text + 8);
+    int hour = parseTwoDigits(text + 11);
+    int minute = parseTwoDigits(text + 14);
+    int second = parseTwoDigits(text + 17);
+
+    if( century < 0 || yearOfCentury < 0 || month < 1 || month > 12 || day < 1 ||
+        hour < 0 || hour > 23 || minute < 0 || minute > 59 || second < 0 || second > 60 )
+    {
+        return false;
+    }
+
+    int year = century * 100 + yearOfCentury;
+    static const int daysInMonth[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    bool leapYear = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+
+    if( day > daysInMonth[month - 1] + (month == 2 && leapYear) )
+        return false;
+
+    size_t pos = 19;
+    uint32_t nanoseconds = 0;
+
+    if( text[pos] == '.' )
+    {
+        size_t digits = 0;
+
+        for(++pos; pos < size && static_cast<unsigned int>(text[pos] - '0') <= 9; ++pos, ++digits)
+        {
+            // Digits beyond nanoseconds are dropped.
+            if( digits < 9 )
+                nanoseconds = nanoseconds * 10 + (text[pos] - '0');
+        }
+
+        if( digits == 0 )
+            return false;
+
+        for(; digits < 9; ++digits)
+            nanoseconds *= 10;
+    }
+
+    int offset = 0;
+
+    if( pos + 1 == size && (text[pos] == 'Z' || text[pos] == 'z') )
+    {
+        offset = 0;
+    }
+    else if( pos + 6 == size && (text[pos] == '+' || text[pos] == '-') && text[pos + 3] == ':' )
+    {
+        int offsetHours = parseTwoDigits(text + pos + 1);
+        int offsetMinutes = parseTwoDigits(text + pos + 4);
+
+        if( offsetHours < 0 || offsetHours > 23 || offsetMinutes < 0 || offsetMinutes > 59 )
+            return false;
+
+        offset = offsetHours * 60 + offsetMinutes;
+
+        if( text[pos] == '-' )
+            offset = -offset;
+    }
+    else
+    {
+        return false;
+    }
+
+    result.seconds = daysFromCivil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second -
+                     offset * 60;
+    result.nanoseconds = nanoseconds;
+    result.utcOffset = static_cast<int16_t>(offset);
+
+    // A leap second at the end of 9999 has no form to be written in.
+    return cborIsValidDateTime(result);
+}
+
+bool cborIsValidDateTime(const CborValue::DateTime &dateTime)
+{
+    static const int64_t minLocal = -62167219200LL; // 0000-01-01T00:00:00
+    static const int64_t maxLocal = 253402300799LL; // 9999-12-31T23:59:59
+    static const int maxOffset = 23 * 60 + 59;
+
+    if( dateTime.nanoseconds >= 1000000000 || dateTime.utcOffset < -maxOffset ||
+        dateTime.utcOffset > maxOffset )
+    {
+        return false;
+    }
+
+    // Bounded first, so the local time can not overflow.
+    if( dateTime.seconds < minLocal - 86400 || dateTime.seconds > maxLocal + 86400 )
+        return false;
+
+    int64_t local = dateTime.seconds + dateTime.utcOffset * 60;
+
+    return local >= minLocal && local <= maxLocal;
+}
+
+static inline char *formatDigits(char *out, unsigned int value, int count)
+{
+    for(int i = count - 1; i >= 0; --i)
+    {
+        out[i] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    }
+
+    return out + count;
+}
+
+size_t cborFormatDateTime(const CborValue::DateTime &dateTime, char *out)
+{
+    int offset = dateTime.utcOffset;
+    int64_t local = dateTime.seconds + offset * 60;
+    int64_t days = local >= 0 ? local / 86400 : (local - 86399) / 86400;
+    unsigned int secondOfDay = static_cast<unsigned int>(local - days * 86400);
+    int64_t year = 0;
+    unsigned int month = 0;
+    unsigned int day = 0;
+
+    civilFromDays(days, year, month, day);
+
+    char *ptr = out;
+
+    ptr = formatDigits(ptr, static_cast<unsigned int>(year), 4);
+    *ptr++ = '-';
+    ptr = formatDigits(ptr, month, 2);
+    *ptr++ = '-';
+    ptr = formatDigits(ptr, day, 2);
+    *ptr++ = 'T';
+    ptr = formatDigits(ptr, secondOfDay / 3600, 2);
+    *ptr++ = ':';
+    ptr = formatDigits(ptr, secondOfDay / 60 % 60, 2);
+    *ptr++ = ':';
+    ptr = formatDigits(ptr, secondOfDay % 60, 2);
+
+    if( dateTime.nanoseconds != 0 )
+    {
+        unsigned int fraction = dateTime.nanoseconds;
+        int digits = 9;
+
+        while( fraction != 0 && fraction % 10 == 0 )
+        {
+            fraction /= 10;
+            --digits;
+        }
+
+        *ptr++ = '.';
+        ptr = formatDigits(ptr, fraction, digits);
+    }
+
+    if( offset == 0 )
+    {
+        *ptr++ = 'Z';
+    }
+    else
+    {
+        *ptr++ = offset < 0 ? '-' : '+';
+        offset = offset < 0 ? -offset : offset;
+        ptr = formatDigits(ptr, offset / 60 % 100, 2);
+        *ptr++ = ':';
+        ptr = formatDigits(ptr, offset % 60, 2);
+    }
+
+    return ptr - out;
+}
+
+size_t cborFormatUnsigned(uint64_t value, char *out)
+{
+    char digits[20];
+    char *end = digits + sizeof(digits);
+    char *ptr = end;
+
+    do
+    {
+        *--ptr = static_cast<char>('0' + value % 10);
+        value /= 10;
+    }
+    while( value != 0 );
+
+    memcpy(out, ptr, end - ptr);
+    return end - ptr;
+}
+
+size_t cborFormatDouble(double value, char *out)
+{
+#if defined(__cpp_lib_to_chars)
+    size_t length = std::to_chars(out, out + cborMaxNumberSize - 2, value).ptr - out;
+#else
+    size_t length = snprintf(out, cborMaxNumberSize - 2, "%.17g", value);
+#endif
+
+    if( memchr(out, '.', length) == 0 && memchr(out, 'e', length) == 0 )
+    {
+        memcpy(out + length, ".0", 2);
+        length += 2;
+    }
+
+    return length;
+}
@@ -11,11 +11,308 @@
 #include <map>
 #include <list>
 #include <stdexcept>
+#include <algorithm>
+#include <iosfwd>
 
 #include <stdint.h>
+#include <string.h>
 
 #include <boost/variant.hpp>
+#include <boost/optional.hpp>
+#include <boost/mpl/begin_end.hpp>
+#include <boost/mpl/distance.hpp>
+#include <boost/mpl/find.hpp>
 #include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
+
+class CborValue;
+
+template<typename T>
+struct CborStorage;
+
+template<typename Iterator>
+class CborRange;
+
+// Bytes of a bignum magnitude. Up to InlineCapacity bytes (128-bit values)
+// are kept inside the object, longer ones on the heap. Compares like
+// std::vector<char>.
+class CborSmallBytes
+{
+public:
+    enum { InlineCapacity = 16 };
+
+    CborSmallBytes()
+        : length(0)
+    {}
+
+    CborSmallBytes(const std::vector<char> &bytes)
+        : length(0)
+    {
+        assign(bytes.data(), bytes.data() + bytes.size());
+    }
+
+    CborSmallBytes(const CborSmallBytes &other)
+        : length(0)
+    {
+        assign(other.data(), other.data() + other.size());
+    }
+
+    CborSmallBytes(CborSmallBytes &&other)
+        : length(other.length)
+    {
+        if( other.isInline() )
+            memcpy(storage.inlineData, other.storage.inlineData, length);
+        else
+            storage.heapData = other.storage.heapData;
+
+        other.length = 0;
+    }
+
+    ~CborSmallBytes()
+    {
+        if( !isInline() )
+            delete[] storage.heapData;
+    }
+
+    CborSmallBytes &operator = (const CborSmallBytes &other)
+    {
+        if( this != &other )
+            assign(other.data(), other.data() + other.size());
+
+        return *this;
+    }
+
+    CborSmallBytes &operator = (CborSmallBytes &&other)
+    {
+        if( this != &other )
+        {
+            if( !isInline() )
+                delete[] storage.heapData;
+
+            length = other.length;
+
+            if( other.isInline() )
+                memcpy(storage.inlineData, other.storage.inlineData, length);
+            else
+                storage.heapData = other.storage.heapData;
+
+            other.length = 0;
+        }
+
+        return *this;
+    }
+
+    template<typename Iterator>
+    void assign(Iterator first, Iterator last)
+    {
+        resize(std::distance(first, last));
+        std::copy(first, last, data());
+    }
+
+    // New bytes are zero.
+    void resize(size_t size)
+    {
+        if( size == length )
+            return;
+
+        if( size <= InlineCapacity )
+        {
+            if( !isInline() )
+            {
+                char *heapData = storage.heapData;
+                memcpy(storage.inlineData, heapData, size);
+                delete[] heapData;
+            }
+            else if( size > length )
+            {
+                memset(storage.inlineData + length, 0, size - length);
+            }
+        }
+        else
+        {
+            char *heapData = new char[size];
+            size_t kept = std::min(size, length);
+
+            memcpy(heapData, data(), kept);
+            memset(heapData + kept, 0, size - kept);
+
+            if( !isInline() )
+                delete[] storage.heapData;
+
+            storage.heapData = heapData;
+        }
+
+        length = size;
+    }
+
+    size_t size() const
+    {
+        return length;
+    }
+
+    bool empty() const
+    {
+        return length == 0;
+    }
+
+    char *data()
+    {
+        return isInline() ? storage.inlineData : storage.heapData;
+    }
+
+    const char *data() const
+    {
+        return isInline() ? storage.inlineData : storage.heapData;
+    }
+
+    const char *begin() const
+    {
+        return data();
+    }
+
+    const char *end() const
+    {
+        return data() + length;
+    }
+
+    char &operator[](size_t index)
+    {
+        return data()[index];
+    }
+
+    const char &operator[](size_t index) const
+    {
+        return data()[index];
+    }
+
+    operator std::vector<char>() const
+    {
+        return std::vector<char>(begin(), end());
+    }
+
+    bool operator == (const CborSmallBytes &other) const {
+        return length == other.length && memcmp(data(), other.data(), length) == 0;
+    }
+
+    bool operator < (const CborSmallBytes &other) const {
+        return std::lexicographical_compare(begin(), end(), other.begin(), other.end());
+    }
+
+private:
+    bool isInline() const
+    {
+        return length <= InlineCapacity;
+    }
+
+    size_t length;
+    union {
+        char inlineData[InlineCapacity];
+        char *heapData;
+    } storage;
+};
+
+// Reference-counted payload of a CborValue. Copies of a value share the
+// payload, which is copied only when one of them is modified. Moving leaves
+// no payload behind; such a value reads as empty data and gets a payload of
+// its own when it is modified.
+template<typename T>
+class CborShared
+{
+public:
+    explicit CborShared(const T &data)
+        : payload(boost::make_shared<Payload>(data))
+    {}
+
+    explicit CborShared(T &&data)
+        : payload(boost::make_shared<Payload>(std::move(data)))
+    {}
+
+    const T &get() const
+    {
+        return payload ? payload->data : empty();
+    }
+
+    // Returns the data for modification, detaching it from other values first.
+    T &mutate()
+    {
+        if( !payload )
+            payload = boost::make_shared<Payload>(T());
+        else if( !payload.unique() )
+            payload = boost::make_shared<Payload>(payload->data);
+
+        payload->hash = 0;
+        return payload->data;
+    }
+
+    // False without a payload: there is no storage to take.
+    bool unique() const
+    {
+        return payload.unique();
+    }
+
+    // The payload, which copies of a value share, null without one.
+    const void *identity() const
+    {
+        return payload.get();
+    }
+
+    // Heap bytes of a payload block made by boost::make_shared: the data,
+    // the cached hash and the control block with its counters, an estimate.
+    static size_t allocationSize()
+    {
+        return sizeof(Payload) + 3 * sizeof(void *);
+    }
+
+    // Hash of the data computed by CborValue::hash(), 0 if not known yet.
+    size_t cachedHash() const
+    {
+        return payload ? __atomic_load_n(&payload->hash, __ATOMIC_RELAXED) : 0;
+    }
+
+    void cacheHash(size_t hash) const
+    {
+        if( payload )
+            __atomic_store_n(&payload->hash, hash, __ATOMIC_RELAXED);
+    }
+
+    bool operator == (const CborShared &other) const {
+        return payload == other.payload || get() == other.get();
+    }
+
+    bool operator < (const CborShared &other) const {
+        return payload != other.payload && get() < other.get();
+    }
+
+private:
+    static const T &empty()
+    {
+        static const T data = T();
+        return data;
+    }
+
+    struct Payload
+    {
+        explicit Payload(const T &data)
+            : data(data), hash(0)
+        {}
+
+        explicit Payload(T &&data)
+            : data(std::move(data)), hash(0)
+        {}
+
+        T data;
+        mutable size_t hash;
+    };
+
+    boost::shared_ptr<Payload> payload;
+};
+
+// Fast non-cryptographic hash of a byte buffer.
+uint64_t cborHashBytes(const void *data, size_t size, uint64_t seed);
+
+// Map keys and array indexes leading from a root value to a nested one.
+typedef std::vector<CborValue> CborPath;
 
 class CborValue {
 public:
@@ -30,7 +327,12 @@ public:
         ByteStringType,
         ArrayType,
         MapType,
-        BigIntegerType
+        BigIntegerType,
+        RawType,
+        DateTimeType,
+        EpochTimeType,
+        DecimalFractionType,
+        BigFloatType
     };
 
     struct NullTag {
@@ -55,7 +357,7 @@ public:
 
     struct BigInteger {
         bool positive;
-        std::vector<char> bigint; // Warning: big-endian byte order.
+        CborSmallBytes bigint; // Warning: big-endian byte order.
 
         bool operator == (const BigInteger &other) const {
             return positive == other.positive && bigint == other.bigint;
@@ -73,6 +375,84 @@ public:
         }
     };
 
+    // Already encoded CBOR data item, written out verbatim.
+    struct Raw {
+        std::vector<char> data;
+
+        bool operator == (const Raw &other) const {
+            return data == other.data;
+        }
+
+        bool operator < (const Raw &other) const {
+            return data < other.data;
+        }
+    };
+
+    // Tag 0: RFC 3339 date/time string. The value is the instant and the
+    // offset it is written in, not the text: it is written back with the
+    // fraction in as few digits as it needs, and a leap second reads as the
+    // first second of the next minute. The local time must fall into years
+    // 0000 to 9999, the offset within 23:59 and the nanoseconds below one
+    // second; CborValue(const DateTime &) throws std::runtime_error otherwise.
+    struct DateTime {
+        int64_t seconds;      // since 1970-01-01T00:00:00Z
+        uint32_t nanoseconds;
+        int16_t utcOffset;    // minutes east of UTC the time is written in
+
+        bool operator == (const DateTime &other) const {
+            return seconds == other.seconds && nanoseconds == other.nanoseconds &&
+                   utcOffset == other.utcOffset;
+        }
+
+        bool operator < (const DateTime &other) const {
+            if( seconds != other.seconds )
+                return seconds < other.seconds;
+            if( nanoseconds != other.nanoseconds )
+                return nanoseconds < other.nanoseconds;
+            return utcOffset < other.utcOffset;
+        }
+    };
+
+    // Tag 1: seconds since 1970-01-01T00:00:00Z, an integer or a float.
+    struct EpochTime {
+        bool integral;
+        int64_t seconds;    // if integral
+        double realSeconds; // otherwise
+
+        bool operator == (const EpochTime &other) const {
+            if( integral != other.integral )
+                return false;
+            return integral ? seconds == other.seconds : realSeconds == other.realSeconds;
+        }
+
+        bool operator < (const EpochTime &other) const {
+            if( integral != other.integral )
+                return integral < other.integral;
+            return integral ? seconds < other.seconds : realSeconds < other.realSeconds;
+        }
+    };
+
+    // Tags 4 and 5: mantissa * Base ^ exponent. Only mantissas which fit
+    // into int64_t are supported.
+    template<int Base>
+    struct ExponentMantissa {
+        int64_t exponent;
+        int64_t mantissa;
+
+        bool operator == (const ExponentMantissa &other) const {
+            return exponent == other.exponent && mantissa == other.mantissa;
+        }
+
+        bool operator < (const ExponentMantissa &other) const {
+            if( exponent != other.exponent )
+                return exponent < other.exponent;
+            return mantissa < other.mantissa;
+        }
+    };
+
+    typedef ExponentMantissa<10> DecimalFraction;
+    typedef ExponentMantissa<2> BigFloat;
+
     class IteratorImpl;
     class Iterator {
     public:
@@ -95,6 +475,13 @@ public:
         boost::scoped_ptr<IteratorImpl> pimpl;
     };
 
+    // Standard iterators over the items of an array and the key/value pairs of
+    // a map, yielding references into the value.
+    typedef std::vector<CborValue>::const_iterator ArrayIterator;
+    typedef std::map<CborValue, CborValue>::const_iterator MapIterator;
+    typedef CborRange<ArrayIterator> ArrayRange;
+    typedef CborRange<MapIterator> MapRange;
+
     CborValue();
     CborValue(NullTag);
     CborValue(UndefinedTag);
@@ -108,11 +495,28 @@ public:
     CborValue(const char *s);
     CborValue(const std::vector<CborValue> &vec);
     CborValue(const std::map<CborValue, CborValue> &map);
+    CborValue(std::string &&s);
+    CborValue(std::vector<char> &&bs);
+    CborValue(std::vector<CborValue> &&vec);
+    CborValue(std::map<CborValue, CborValue> &&map);
     CborValue(const BigInteger &bigint);
+    CborValue(const DateTime &dateTime);
+    CborValue(const EpochTime &epochTime);
+    CborValue(const DecimalFraction &decimalFraction);
+    CborValue(const BigFloat &bigFloat);
 
     static CborValue null();
     static CborValue undefiend();
 
+    // Wraps one encoded data item. Throws std::runtime_error if the data is
+    // not exactly one well-formed item. A raw value is equal only to a raw
+    // value with the same bytes, not to the value it encodes.
+    static CborValue raw(const std::vector<char> &encoded);
+
+    // Parses an RFC 3339 date/time, throws std::runtime_error if it is
+    // invalid.
+    static CborValue dateTime(const std::string &text);
+
     bool isNull() const;
     bool isUndefined() const;
     bool isBool() const;
@@ -124,6 +528,11 @@ public:
     bool isArray() const;
     bool isMap() const;
     bool isBigInteger() const;
+    bool isRaw() const;
+    bool isDateTime() const;
+    bool isEpochTime() const;
+    bool isDecimalFraction() const;
+    bool isBigFloat() const;
 
     bool toBool() const;
     uint64_t toPositiveInteger() const;
@@ -134,10 +543,50 @@ public:
     std::vector<CborValue> toArray() const;
     std::map<CborValue, CborValue> toMap() const;
     BigInteger toBigInteger() const;
+    std::vector<char> toRaw() const;
+    DateTime toDateTime() const;
+    EpochTime toEpochTime() const;
+    DecimalFraction toDecimalFraction() const;
+    BigFloat toBigFloat() const;
+
+    // Returns a pointer to the stored data if the value holds a T, null
+    // otherwise. T is bool, double, std::string, std::vector<char>,
+    // std::vector<CborValue>, std::map<CborValue, CborValue>, BigInteger,
+    // Raw, DateTime, EpochTime, DecimalFraction or BigFloat. The pointer is
+    // valid until the value is modified.
+    template<typename T>
+    const T *getIf() const;
+
+    // Returns the integer if it fits into int64_t, nothing otherwise.
+    boost::optional<int64_t> tryToInt64() const;
 
     Type type() const;
+
+    // Diagnostic notation (RFC 8949, section 8), e.g. {"a": [1, h'ff']},
+    // written in one pass without copies of the children. Arrays and maps
+    // nested deeper than maxDepth are written as [...] and {...}; text
+    // longer than maxLength bytes is cut and ends with "...". The stream is
+    // written in chunks, the string overload appends.
+    static const size_t noLimit = static_cast<size_t>(-1);
+
+    void writeDiagnostic(std::ostream &stream, size_t maxDepth = noLimit, size_t maxLength = noLimit) const;
+    void writeDiagnostic(std::string &text, size_t maxDepth = noLimit, size_t maxLength = noLimit) const;
+
+    // The whole value in diagnostic notation.
     std::string inspect() const;
 
+    // Heap bytes owned by the value tree, an estimate for the usual standard
+    // library: the capacity of strings and vectors with their slack, a node
+    // per map member, bignums which do not fit inline and the block of
+    // every payload. A payload shared by several places of the tree is
+    // counted once; the CborValue object itself is not counted.
+    size_t memoryUsage() const;
+
+    // Structural hash: equal values have equal hashes. Hashes of arrays and
+    // maps computed with the default seed are cached in their payload.
+    static const size_t defaultHashSeed = 0x9e3779b97f4a7c15ULL;
+    size_t hash(size_t seed = defaultHashSeed) const;
+
     // map and array
     size_t size() const;
     bool isEmpty() const;
@@ -154,9 +603,32 @@ public:
     template<typename T>
     CborValue member(const T &key) const;
 
+    // Returns the member, or null if the value is not a map or has no such
+    // key. The pointer is valid until the map is modified.
+    const CborValue *find(const CborValue &key) const;
+    const CborValue *find(const char *key) const;
+
+    template<typename T>
+    const CborValue *find(const T &key) const;
+
     // for array
     CborValue at(size_t arrayIndex) const;
 
+    // Throw std::runtime_error if the value is not an array or a map:
+    //   for(const CborValue &item : value.arrayItems()) ...
+    //   for(const auto &member : value.mapItems()) ...
+    ArrayRange arrayItems() const;
+    MapRange mapItems() const;
+
+    // Modification. Copies of a value share their strings, arrays and maps,
+    // so these copy the shared payload first; other copies are not affected.
+    void append(const CborValue &item);
+    void setAt(size_t arrayIndex, const CborValue &item);
+    // Cuts an array to size items or adds nulls up to it.
+    void resize(size_t size);
+    void setMember(const CborValue &key, const CborValue &value);
+    bool removeMember(const CborValue &key);
+
     template<typename T>
     static CborValue convertFrom(const std::vector<T> &arr);
 
@@ -174,6 +646,7 @@ protected:
     bool typeEq() const;
 
 private:
+    CborValue(const Raw &raw);
 
     struct PositiveInteger
     {
@@ -200,12 +673,28 @@ private:
         uint64_t value;
     };
 
+    typedef CborShared<std::string> SharedString;
+    typedef CborShared< std::vector<char> > SharedByteString;
+    typedef CborShared< std::vector<CborValue> > SharedArray;
+    typedef CborShared< std::map<CborValue, CborValue> > SharedMap;
+    typedef CborShared<Raw> SharedRaw;
+
     typedef boost::variant<NullTag, UndefinedTag, bool, PositiveInteger, NegativeInteger,
-                           double, std::string, std::vector<char>, std::vector<CborValue>,
-                           std::map<CborValue, CborValue>, BigInteger > Variant;
+                           double, SharedString, SharedByteString, SharedArray,
+                           SharedMap, BigInteger, SharedRaw, DateTime, EpochTime,
+                           DecimalFraction, BigFloat > Variant;
 
     Variant value;
 
+    // Position of the storage of T in Variant, compared with which().
+    template<typename T>
+    struct StorageIndex
+        : boost::mpl::distance<
+              typename boost::mpl::begin<Variant::types>::type,
+              typename boost::mpl::find<Variant::types, typename CborStorage<T>::Type>::type>
+    {};
+
+    friend class CborDecoder;
     friend bool operator < (const CborValue &lhs, const CborValue &rhs);
     friend bool operator == (const CborValue &lhs, const CborValue &rhs);
 };
@@ -213,6 +702,45 @@ private:
 bool operator < (const CborValue &lhs, const CborValue &rhs);
 bool operator == (const CborValue &lhs, const CborValue &rhs);
 
+// Iterators of an array or a map. The range shares the payload of the value,
+// so iterating over a temporary value is safe.
+template<typename Iterator>
+class CborRange
+{
+public:
+    typedef Iterator iterator;
+    typedef Iterator const_iterator;
+
+    CborRange(const CborValue &owner, Iterator first, Iterator last)
+        : owner(owner), first(first), last(last)
+    {}
+
+    Iterator begin() const
+    {
+        return first;
+    }
+
+    Iterator end() const
+    {
+        return last;
+    }
+
+    bool empty() const
+    {
+        return first == last;
+    }
+
+private:
+    CborValue owner;
+    Iterator first;
+    Iterator last;
+};
+
+inline bool operator != (const CborValue &lhs, const CborValue &rhs)
+{
+    return !(lhs == rhs);
+}
+
 
 inline bool CborValue::hasMember(const char *key) const
 {
@@ -236,11 +764,69 @@ CborValue CborValue::member(const T &key) const
     return member(CborValue(key));
 }
 
+inline const CborValue *CborValue::find(const char *key) const
+{
+    return find(CborValue(key));
+}
+
+template<typename T>
+const CborValue *CborValue::find(const T &key) const
+{
+    return find(CborValue(key));
+}
+
+// How a type returned by CborValue::castTo is stored in the variant.
+template<typename T>
+struct CborStorage
+{
+    typedef T Type;
+
+    static const T &get(const T &value) {
+        return value;
+    }
+};
+
+template<typename T>
+struct CborSharedStorage
+{
+    typedef CborShared<T> Type;
+
+    static const T &get(const CborShared<T> &value) {
+        return value.get();
+    }
+};
+
+template<>
+struct CborStorage<std::string> : CborSharedStorage<std::string> {};
+
+template<>
+struct CborStorage< std::vector<char> > : CborSharedStorage< std::vector<char> > {};
+
+template<>
+struct CborStorage< std::vector<CborValue> > : CborSharedStorage< std::vector<CborValue> > {};
+
+template<>
+struct CborStorage< std::map<CborValue, CborValue> > : CborSharedStorage< std::map<CborValue, CborValue> > {};
+
+template<>
+struct CborStorage<CborValue::Raw> : CborSharedStorage<CborValue::Raw> {};
+
+template<typename T>
+const T *CborValue::getIf() const
+{
+    typedef typename CborStorage<T>::Type Stored;
+
+    if( value.which() != StorageIndex<T>::value )
+        return 0;
+
+    return &CborStorage<T>::get(*boost::get<Stored>(&value));
+}
+
 template<typename T>
 T CborValue::castTo() const
 {
-    if( value.type() == typeid(T) )
-        return boost::get<T>(value);
+    if( const T *data = getIf<T>() )
+        return *data;
     // else
     //    return T();
 
@@ -250,10 +836,7 @@ T CborValue::castTo() const
 template<typename T>
 bool CborValue::typeEq() const
 {
-    if( value.type() == typeid(T) )
-        return true;
-    else
-        return false;
+    return value.which() == StorageIndex<T>::value;
 }
 
 template<typename T>
@@ -282,4 +865,17 @@ CborValue CborValue::convertFrom(const std::map<TKey, TValue> &map)
     return result;
 }
 
+namespace std {
+
+template<>
+struct hash<CborValue>
+{
+    size_t operator()(const CborValue &value) const
+    {
+        return value.hash();
+    }
+};
+
+} // namespace std
+
 #endif // VALUE_H
@@ -5,6 +5,12 @@
 
 // See http://tools.ietf.org/search/rfc7049
 
+#include <algorithm>
+#include <exception>
+#include <functional>
+#include <thread>
+#include <unordered_map>
+
 #include <string.h>
 #include <endian.h>
 #include <stdint.h>
@@ -24,386 +30,707 @@ static const int textBasedDateTime = taggedStart;      // 0xc0
 static const int epochBasedDateTime = taggedStart + 1; // 0xc1
 static const int positiveBignum = taggedStart + 2;     // 0xc2
 static const int negativeBignum = taggedStart + 3;     // 0xc3
+static const int decimalFraction = taggedStart + 4;    // 0xc4
+static const int bigFloat = taggedStart + 5;           // 0xc5
+static const int stringReference = 25;
+static const int shareable = 28;
+static const int sharedReference = 29;
+static const int stringReferenceNamespace = 256;
 //...
 static const int simpleStart = 0xe0;
 static const int halfPrecisionFloat = simpleStart + 0x19;   // 0xf9
 static const int singlePrecisionFloat = simpleStart + 0x1a; // 0xfa
 static const int doublePrecisionFloat = simpleStart + 0x1b; // 0xfb
 
-static void cborWriteInternal(std::vector<char> &buff, const CborValue &value);
+struct WriterState
+{
+    WriterState()
+        : deterministic(false)
+        , threadsCount(1)
+        , stringReferences(false)
+        , inNamespace(false)
+        , nextStringIndex(0)
+        , valueSharing(false)
+        , sharing(false)
+        , nextSharedIndex(0)
+    {}
+
+    // Encoded map keys for the deterministic mode. Only scalar keys are
+    // cached; the cache is trimmed between documents, never while writing,
+    // so pointers to the cached encodings stay valid.
+    typedef std::map<CborValue, std::vector<char> > KeyCache;
+    enum { MaxCachedKeys = 4096 };
+
+    bool deterministic;
+    KeyCache keyCache;
+
+    // Arrays and maps with at least ParallelMinItems items are split into
+    // ranges encoded by threadsCount threads.
+    enum { ParallelMinItems = 1024 };
+
+    size_t threadsCount;
+
+    // Stringref namespace of the document being written. A string keeps
+    // the index of its first occurrence, but every string sent in full
+    // which is long enough takes the next index, as the decoder counts them.
+    typedef std::unordered_map<CborValue, uint64_t> StringTable;
+
+    bool stringReferences;
+    bool inNamespace;
+    StringTable strings;
+    uint64_t nextStringIndex;
+
+    // Value sharing (tags 28 and 29): arrays and maps by the count of their
+    // occurrences in the document. An item which occurs more than once is
+    // written once as shareable, its other copies refer to that index.
+    struct SharedEntry
+    {
+        SharedEntry()
+            : count(0), written(false), index(0)
+        {}
+
+        size_t count;
+        bool written;
+        uint64_t index;
+    };
 
-static void writeNull(std::vector<char> &buff)
+    typedef std::unordered_map<CborValue, SharedEntry> SharingTable;
+
+    bool valueSharing;
+    bool sharing;
+    SharingTable sharedValues;
+    uint64_t nextSharedIndex;
+};
+
+class CborWriter::Impl : public WriterState
+{
+};
+
+typedef CborOutputBuffer< std::vector<char> > OutputBuffer;
+
+static void cborWriteInternal(WriterState &writer, OutputBuffer &out,
+                              const CborValue &value);
+
+static void writeNull(OutputBuffer &out)
 {
     const char nil = static_cast<char>(0xf6);
-    buff.push_back(nil);
+    out.put(nil);
 }
 
-static void writeUndefined(std::vector<char> &buff)
+static void writeUndefined(OutputBuffer &out)
 {
     const char undefined = static_cast<char>(0xf7);
-    buff.push_back(undefined);
+    out.put(undefined);
 }
 
-static void writeBool(std::vector<char> &buff, const CborValue &value)
+static void writeBool(OutputBuffer &out, const CborValue &value)
 {
     const char trueValue = static_cast<char>(0xf5);
     const char falseValue = static_cast<char>(0xf4);
 
     if( value.toBool() )
-        buff.push_back(trueValue);
+        out.put(trueValue);
     else
-        buff.push_back(falseValue);
+        out.put(falseValue);
 }
 
-static void writeInteger(std::vector<char> &buff, uint64_t value, int type)
+static void writeHeader(OutputBuffer &out, uint64_t value, int type)
 {
-    assert(type + 24 < 256);
-
-    if( value < 24 )
-    {
-        uint8_t byte = type + value;
-
-        buff.push_back(byte);
-    }
-    else if( value < 256 )
-    {
-        uint8_t bytes[2] = {static_cast<uint8_t>(type + 24), static_cast<uint8_t>(value)};
-
-        buff.insert(buff.end(), bytes, bytes + sizeof(bytes));
-    }
-    else if( value < 65536 )
-    {
-        uint16_t ui16 = htobe16(value);
-        uint8_t bytes[3] = {
-            static_cast<uint8_t>(type + 25),
-            static_cast<uint8_t>(ui16 & 0xff),
-            static_cast<uint8_t>((ui16 & 0xff00) >> 8)
-        };
-
-        buff.insert(buff.end(), bytes, bytes + sizeof(bytes));
-    }
-    else if( value < 4294967296LU )
-    {
-        uint32_t ui32 = htobe32(value);
-        uint8_t bytes[5] = {
-            static_cast<uint8_t>(type + 26),
-            static_cast<uint8_t>(ui32 & 0xff),
-            static_cast<uint8_t>((ui32 & 0xff00) >> 8),
-            static_cast<uint8_t>((ui32 & 0xff0000) >> 16),
-            static_cast<uint8_t>((ui32 & 0xff000000) >> 24)
-        };
-
-        buff.insert(buff.end(), bytes, bytes + sizeof(bytes));
-    }
-    else
-    {
-        uint64_t ui64 = htobe64(value);
-        uint8_t bytes[9] = {
-            static_cast<uint8_t>(type + 27),
-            static_cast<uint8_t>(ui64 & 0xff),
-            static_cast<uint8_t>((ui64 & 0xff00) >> 8),
-            static_cast<uint8_t>((ui64 & 0xff0000) >> 16),
-            static_cast<uint8_t>((ui64 & 0xff000000) >> 24),
-            static_cast<uint8_t>((ui64 & 0xff00000000UL) >> 32),
-            static_cast<uint8_t>((ui64 & 0xff0000000000UL) >> 40),
-            static_cast<uint8_t>((ui64 & 0xff000000000000UL) >> 48),
-            static_cast<uint8_t>((ui64 & 0xff00000000000000UL) >> 56)
-        };
-
-        buff.insert(buff.end(), bytes, bytes + sizeof(bytes));
-    }
+    out.commit(cborEncodeHeader(out.reserve(cborMaxHeaderSize), value, type));
 }
 
-static void writePositiveInteger(std::vector<char> &buff, const CborValue &value)
+static void writePositiveInteger(OutputBuffer &out, const CborValue &value)
 {
     uint64_t i = value.toPositiveInteger();
 
     if( i > 0 )
     {
-        writeInteger(buff, i, positiveIntegerStart);
+        writeHeader(out, i, positiveIntegerStart);
     }
     else
     {
         const char zero = 0;
-        buff.push_back(zero);
+        out.put(zero);
     }
 }
 
-static void writeNegativeInteger(std::vector<char> &buff, const CborValue &value)
+static void writeNegativeInteger(OutputBuffer &out, const CborValue &value)
 {
     uint64_t i = value.toNegativeInteger();
 
     if( i == 0 )
     {
-        writeInteger(buff, 0xFFFFFFFFFFFFFFFF, negativeIntegerStart);
+        writeHeader(out, 0xFFFFFFFFFFFFFFFF, negativeIntegerStart);
     }
     else
     {
-        writeInteger(buff, i - 1, negativeIntegerStart);
+        writeHeader(out, i - 1, negativeIntegerStart);
+    }
+}
+
+// Counts a string which is written in full inside a stringref namespace.
+static void addNamespaceString(WriterState &writer, const CborValue &value, size_t length)
+{
+    if( cborIsStringReferenceCandidate(length, writer.nextStringIndex) )
+        writer.strings.emplace(value, writer.nextStringIndex++);
+}
+
+// Writes a reference to a string sent before. Returns false if the string
+// has to be written in full.
+static bool writeStringReference(WriterState &writer, OutputBuffer &out,
+                                 const CborValue &value, size_t length)
+{
+    if( !writer.inNamespace )
+        return false;
+
+    WriterState::StringTable::const_iterator it = writer.strings.find(value);
+
+    if( it == writer.strings.end() )
+    {
+        addNamespaceString(writer, value, length);
+        return false;
     }
+
+    writeHeader(out, stringReference, taggedStart);
+    writeHeader(out, it->second, positiveIntegerStart);
+    return true;
 }
 
-static void writeString(std::vector<char> &buff, const CborValue &value)
+static void writeString(WriterState &writer, OutputBuffer &out, const CborValue &value)
 {
-    const std::string &s = value.toString();
+    const std::string &s = *value.getIf<std::string>();
+
+    if( writeStringReference(writer, out, value, s.size()) )
+        return;
 
-    writeInteger(buff, s.size(), utf8StringStart);
+    writeHeader(out, s.size(), utf8StringStart);
 
-    buff.insert(buff.end(), s.begin(), s.end());
+    out.append(s.data(), s.size());
 }
 
-static void writeByteString(std::vector<char> &buff, const CborValue &value)
+static void writeByteString(WriterState &writer, OutputBuffer &out, const CborValue &value)
 {
-    const std::vector<char> &data = value.toByteString();
+    const std::vector<char> &data = *value.getIf< std::vector<char> >();
 
-    writeInteger(buff, data.size(), byteStringStart);
+    if( writeStringReference(writer, out, value, data.size()) )
+        return;
 
-    buff.insert(buff.end(), data.begin(), data.end());
+    writeHeader(out, data.size(), byteStringStart);
+
+    out.append(data.data(), data.size());
 }
 
 
-static void writeDouble(std::vector<char> &buff, const CborValue &value)
+static void writeDouble(OutputBuffer &out, const CborValue &value)
 {
-    double dv = value.toDouble();
-    float fv = dv;
+    out.commit(cborEncodeDouble(out.reserve(cborMaxHeaderSize), value.toDouble()));
+}
 
-    if( fv == dv )
-    {
-        // Warning: code from MessagePack
+// Items of a container encoded in parallel: a function which writes item i.
+typedef std::function<void (WriterState &, OutputBuffer &, size_t)> ItemWriter;
 
-        union {
-            float f;
-            uint32_t ui32;
-        } buf = { fv };
+static bool canWriteInParallel(const WriterState &writer, size_t count)
+{
+    // References and shared values are numbered in the document order.
+    return writer.threadsCount > 1 && count >= WriterState::ParallelMinItems &&
+            !writer.inNamespace && !writer.sharing;
+}
 
-        int i32 = buf.ui32;
-        if ((i32 & 0x1FFF) == 0)
+// Joins the threads which were started, also when starting the next one or
+// the encoding throws.
+struct ThreadsJoiner
+{
+    std::vector<std::thread> &threads;
+
+    ~ThreadsJoiner()
+    {
+        for(size_t i = 0; i < threads.size(); ++i)
         {
-            do
-            {
-                // IEEE 754 half-precision
-                uint16_t s16 = (i32 >> 16) & 0x8000;
-                int exponent = (i32 >> 23) & 0xff;
-                int mantissa = i32 & 0x7fffff;
+            if( threads[i].joinable() )
+                threads[i].join();
+        }
+    }
+};
+
+// Every thread encodes a contiguous range of the items into its own buffer
+// with its own state, the buffers are appended in order. The result is the
+// same as the serial encoding. An exception of a thread is thrown again on
+// the calling thread, as the serial encoder would throw it.
+static void writeInParallel(WriterState &writer, OutputBuffer &out, size_t count,
+                            const ItemWriter &writeItem)
+{
+    size_t threadsCount = std::min(writer.threadsCount, count);
+    size_t chunk = (count + threadsCount - 1) / threadsCount;
+    std::vector< std::vector<char> > buffers(threadsCount);
+    std::vector<std::exception_ptr> errors(threadsCount);
+    std::vector<std::thread> threads;
 
-                if (exponent == 0 && mantissa == 0)
-                {
-                    ;
-                }
-                else if (exponent >= 113 && exponent <= 142)
-                {
-                    // normalized
-                    s16 += ((exponent - 112) << 10) + (mantissa >> 13);
-                }
-                else if (exponent >= 103 && exponent < 113)
+    threads.reserve(threadsCount);
+
+    {
+        ThreadsJoiner joiner = {threads};
+
+        for(size_t i = 0; i < threadsCount; ++i)
+        {
+            size_t first = std::min(count, i * chunk);
+            size_t last = std::min(count, first + chunk);
+            std::vector<char> &buff = buffers[i];
+            std::exception_ptr &error = errors[i];
+            bool deterministic = writer.deterministic;
+
+            threads.push_back(std::thread([&writeItem, &buff, &error, first, last, deterministic]() {
+                try
                 {
-                    // denorm, exp16 = 0
-                    if (mantissa & ((1 << (126 - exponent)) - 1))
-                        break; // loss of precision
-                    s16 += ((mantissa + 0x800000) >> (126 - exponent));
+                    WriterState state;
+                    OutputBuffer chunkOut(buff);
+
+                    state.deterministic = deterministic;
+
+                    for(size_t item = first; item < last; ++item)
+                        writeItem(state, chunkOut, item);
                 }
-                else if (exponent == 255 && mantissa == 0)
+                catch(...)
                 {
-                    // Inf
-                    s16 += 0x7c00;
-                }
-                else
-                {
-                    break;  // loss of range
+                    error = std::current_exception();
                 }
+            }));
+        }
+    }
 
-                s16 = htobe16(s16);
+    size_t size = 0;
 
-                uint8_t bytes[3] = {
-                    halfPrecisionFloat,
-                    static_cast<uint8_t>(s16 & 0xff),
-                    static_cast<uint8_t>((s16 & 0xff00) >> 8)
-                };
+    for(size_t i = 0; i < threadsCount; ++i)
+    {
+        if( errors[i] )
+            std::rethrow_exception(errors[i]);
 
-                buff.insert(buff.end(), bytes, bytes + sizeof(bytes));
-                return;
-            } while(0);
-        }
+        size += buffers[i].size();
+    }
 
+    // One allocation for the joined output.
+    if( size != 0 )
+        out.reserve(size);
 
-        // IEEE 754 single-precision
-        buf.ui32 = htobe32(buf.ui32);
+    for(size_t i = 0; i < threadsCount; ++i)
+        out.append(buffers[i].data(), buffers[i].size());
+}
 
-        uint8_t bytes[5] = {
-            singlePrecisionFloat,
-            static_cast<uint8_t>(buf.ui32 & 0xff),
-            static_cast<uint8_t>((buf.ui32 & 0xff00) >> 8),
-            static_cast<uint8_t>((buf.ui32 & 0xff0000) >> 16),
-            static_cast<uint8_t>((buf.ui32 & 0xff000000) >> 24),
-        };
+static void writeArray(WriterState &writer, OutputBuffer &out, const CborValue &value)
+{
+    const std::vector<CborValue> &arr = *value.getIf< std::vector<CborValue> >();
 
-        buff.insert(buff.end(), bytes, bytes + sizeof(bytes));
-    }
-    else if( dv != dv )
-    {
-        // NaN
-        uint8_t bytes[3] = {halfPrecisionFloat, 0x7e, 0x00};
+    writeHeader(out, arr.size(), arrayStart);
 
-        buff.insert(buff.end(), bytes, bytes + sizeof(bytes));
+    if( canWriteInParallel(writer, arr.size()) )
+    {
+        writeInParallel(writer, out, arr.size(), [&arr](WriterState &state, OutputBuffer &itemOut, size_t i) {
+            cborWriteInternal(state, itemOut, arr[i]);
+        });
+        return;
     }
-    else
+
+    for(size_t i = 0; i < arr.size(); ++i)
     {
-        // IEEE 754 double-precision
-        union {
-            double dv;
-            uint64_t ui64;
-        } buf = { dv };
-
-        buf.ui64 = htobe64(buf.ui64);
-
-        uint8_t bytes[9] = {
-            doublePrecisionFloat,
-            static_cast<uint8_t>(buf.ui64 & 0xff),
-            static_cast<uint8_t>((buf.ui64 & 0xff00) >> 8),
-            static_cast<uint8_t>((buf.ui64 & 0xff0000) >> 16),
-            static_cast<uint8_t>((buf.ui64 & 0xff000000) >> 24),
-            static_cast<uint8_t>((buf.ui64 & 0xff00000000UL) >> 32),
-            static_cast<uint8_t>((buf.ui64 & 0xff0000000000UL) >> 40),
-            static_cast<uint8_t>((buf.ui64 & 0xff000000000000UL) >> 48),
-            static_cast<uint8_t>((buf.ui64 & 0xff00000000000000UL) >> 56)
-        };
-
-
-        buff.insert(buff.end(), bytes, bytes + sizeof(bytes));
+        cborWriteInternal(writer, out, arr[i]);
     }
 }
 
-static void writeArray(std::vector<char> &buff, const CborValue &value)
+namespace {
+
+struct DeterministicEntry
+{
+    const std::vector<char> *key;
+    const CborValue *keyValue;
+    const CborValue *value;
+};
+
+// Bytewise lexicographic order of the encoded keys, RFC 8949 section 4.2.1.
+bool operator < (const DeterministicEntry &lhs, const DeterministicEntry &rhs)
+{
+    size_t size = std::min(lhs.key->size(), rhs.key->size());
+    int result = memcmp(lhs.key->data(), rhs.key->data(), size);
+
+    if( result != 0 )
+        return result < 0;
+
+    return lhs.key->size() < rhs.key->size();
+}
+
+} // namespace
+
+static void writeDeterministicMap(WriterState &writer, OutputBuffer &out,
+                                  const std::map<CborValue, CborValue> &map)
 {
-    const std::vector<CborValue> &arr = value.toArray();
+    std::map<CborValue, CborValue>::const_iterator it = map.begin();
+    std::map<CborValue, CborValue>::const_iterator end = map.end();
+    std::vector<DeterministicEntry> entries;
+    std::vector< std::vector<char> > uncachedKeys;
 
-    writeInteger(buff, arr.size(), arrayStart);
+    entries.reserve(map.size());
 
-    for(size_t i = 0; i < arr.size(); ++i)
+    // Keys are sorted by their plain encoding, references are not known yet.
+    bool inNamespace = writer.inNamespace;
+    bool sharing = writer.sharing;
+
+    writer.inNamespace = false;
+    writer.sharing = false;
+
+    for(; it != end; ++it)
     {
-        cborWriteInternal(buff, arr[i]);
+        const CborValue &key = it->first;
+        DeterministicEntry entry = {0, &key, &it->second};
+
+        if( key.isArray() || key.isMap() || key.isRaw() )
+        {
+            if( uncachedKeys.empty() )
+                uncachedKeys.reserve(map.size());
+
+            uncachedKeys.push_back(std::vector<char>());
+
+            OutputBuffer keyOut(uncachedKeys.back());
+            cborWriteInternal(writer, keyOut, key);
+            entry.key = &uncachedKeys.back();
+        }
+        else
+        {
+            WriterState::KeyCache::iterator cached = writer.keyCache.lower_bound(key);
+
+            if( cached == writer.keyCache.end() || !(cached->first == key) )
+            {
+                cached = writer.keyCache.insert(cached, std::make_pair(key, std::vector<char>()));
+
+                OutputBuffer keyOut(cached->second);
+                cborWriteInternal(writer, keyOut, key);
+            }
+
+            entry.key = &cached->second;
+        }
+
+        entries.push_back(entry);
+    }
+
+    writer.inNamespace = inNamespace;
+    writer.sharing = sharing;
+
+    // Repeated key sets of the same shape are usually sorted already.
+    if( std::is_sorted(entries.begin(), entries.end()) == false )
+        std::sort(entries.begin(), entries.end());
+
+    if( canWriteInParallel(writer, entries.size()) )
+    {
+        // The threads only read the encoded keys, the cache is not changed
+        // until the map is written.
+        writeInParallel(writer, out, entries.size(), [&entries](WriterState &state, OutputBuffer &itemOut, size_t i) {
+            itemOut.append(entries[i].key->data(), entries[i].key->size());
+            cborWriteInternal(state, itemOut, *entries[i].value);
+        });
+        return;
+    }
+
+    for(size_t i = 0; i < entries.size(); ++i)
+    {
+        if( inNamespace || sharing )
+            cborWriteInternal(writer, out, *entries[i].keyValue);
+        else
+            out.append(entries[i].key->data(), entries[i].key->size());
+
+        cborWriteInternal(writer, out, *entries[i].value);
     }
 }
 
-static void writeMap(std::vector<char> &buff, const CborValue &value)
+static void writeMap(WriterState &writer, OutputBuffer &out, const CborValue &value)
 {
-    const std::map<CborValue, CborValue> &map = value.toMap();
+    const std::map<CborValue, CborValue> &map = *value.getIf< std::map<CborValue, CborValue> >();
     std::map<CborValue, CborValue>::const_iterator it = map.begin();
     std::map<CborValue, CborValue>::const_iterator end = map.end();
 
-    writeInteger(buff, map.size(), mapStart);
+    writeHeader(out, map.size(), mapStart);
+
+    if( writer.deterministic )
+    {
+        writeDeterministicMap(writer, out, map);
+        return;
+    }
+
+    if( canWriteInParallel(writer, map.size()) )
+    {
+        std::vector<std::map<CborValue, CborValue>::const_iterator> members;
+
+        members.reserve(map.size());
+
+        for(; it != end; ++it)
+            members.push_back(it);
+
+        writeInParallel(writer, out, members.size(), [&members](WriterState &state, OutputBuffer &itemOut, size_t i) {
+            cborWriteInternal(state, itemOut, members[i]->first);
+            cborWriteInternal(state, itemOut, members[i]->second);
+        });
+        return;
+    }
 
     for(; it != end; ++it)
     {
-        cborWriteInternal(buff, it->first);
-        cborWriteInternal(buff, it->second);
+        cborWriteInternal(writer, out, it->first);
+        cborWriteInternal(writer, out, it->second);
     }
 }
 
-static void writeBigInteger(std::vector<char> &buff, const CborValue &value)
+static void writeBigInteger(WriterState &writer, OutputBuffer &out, const CborValue &value)
 {
-    CborValue::BigInteger bigInteger = value.toBigInteger();
+    const CborValue::BigInteger &bigInteger = *value.getIf<CborValue::BigInteger>();
+    const CborSmallBytes &bigint = bigInteger.bigint;
 
-    bool canBeWrittenAs64BitInteger = bigInteger.bigint.size() < 9;
+    bool canBeWrittenAs64BitInteger = bigint.size() < 9;
     canBeWrittenAs64BitInteger = canBeWrittenAs64BitInteger || (
-                                    bigInteger.bigint.size() == 9 &&
-                                    bigInteger.bigint[8] == 0 &&
-                                    bigInteger.bigint[7] == 0 &&
-                                    bigInteger.bigint[6] == 0 &&
-                                    bigInteger.bigint[5] == 0 &&
-                                    bigInteger.bigint[4] == 0 &&
-                                    bigInteger.bigint[3] == 0 &&
-                                    bigInteger.bigint[2] == 0 &&
-                                    bigInteger.bigint[1] == 0 &&
-                                    bigInteger.bigint[0] == 1 &&
+                                    bigint.size() == 9 &&
+                                    bigint[8] == 0 &&
+                                    bigint[7] == 0 &&
+                                    bigint[6] == 0 &&
+                                    bigint[5] == 0 &&
+                                    bigint[4] == 0 &&
+                                    bigint[3] == 0 &&
+                                    bigint[2] == 0 &&
+                                    bigint[1] == 0 &&
+                                    bigint[0] == 1 &&
                                     bigInteger.positive == false);
 
     if(canBeWrittenAs64BitInteger)
     {
         // This number can be written as integer value.
 
-        if( bigInteger.bigint.size() == 9 )
+        if( bigint.size() == 9 )
         {
-            writeInteger(buff, 0xFFFFFFFFFFFFFFFF, negativeIntegerStart);
+            writeHeader(out, 0xFFFFFFFFFFFFFFFF, negativeIntegerStart);
         }
         else
         {
             uint64_t ui = 0;
 
-            for(size_t i = 0; i < bigInteger.bigint.size(); ++i)
-                ui = bigInteger.bigint[i] + (ui << 8);
+            for(size_t i = 0; i < bigint.size(); ++i)
+                ui = static_cast<unsigned char>(bigint[i]) + (ui << 8);
 
             if( bigInteger.positive)
-                writeInteger(buff, ui, positiveIntegerStart);
+                writeHeader(out, ui, positiveIntegerStart);
             else
-                writeInteger(buff, ui - 1, negativeIntegerStart);
+                writeHeader(out, ui - 1, negativeIntegerStart);
         }
     }
     else
     {
-        if( bigInteger.positive )
+        // The magnitude is copied straight into the output and a negative
+        // one is decremented there. 1 followed by zeros loses a byte.
+        size_t skip = 0;
+
+        if( !bigInteger.positive && bigint[0] == 1 &&
+            std::count(bigint.begin() + 1, bigint.end(), 0) == static_cast<ptrdiff_t>(bigint.size() - 1) )
         {
-            buff.push_back(static_cast<char>(positiveBignum));
+            skip = 1;
         }
-        else
-        {
-            buff.push_back(static_cast<char>(negativeBignum));
 
-            for(size_t i = bigInteger.bigint.size(); i != 0 ; --i)
+        size_t length = bigint.size() - skip;
+
+        out.put(static_cast<char>(bigInteger.positive ? positiveBignum : negativeBignum));
+        writeHeader(out, length, byteStringStart);
+
+        char *ptr = out.reserve(length);
+
+        memcpy(ptr, bigint.data() + skip, length);
+        out.commit(length);
+
+        if( !bigInteger.positive )
+        {
+            for(size_t i = length; i != 0 ; --i)
             {
-                unsigned char c = bigInteger.bigint[i - 1];
+                unsigned char c = ptr[i - 1];
                 if( c != 0 )
                 {
-                    bigInteger.bigint[i - 1] = c - 1u;
+                    ptr[i - 1] = c - 1u;
                     break;
                 }
                 else
                 {
-                    bigInteger.bigint[i - 1] = static_cast<char>(0xff);
+                    ptr[i - 1] = static_cast<char>(0xff);
                 }
             }
         }
 
-        writeByteString(buff, CborValue(bigInteger.bigint));
+        // The magnitude is a byte string for the decoder as well.
+        if( writer.inNamespace && cborIsStringReferenceCandidate(length, writer.nextStringIndex) )
+            addNamespaceString(writer, CborValue(std::vector<char>(ptr, ptr + length)), length);
+    }
+}
+
+static void writeInt64(OutputBuffer &out, int64_t value)
+{
+    if( value >= 0 )
+        writeHeader(out, static_cast<uint64_t>(value), positiveIntegerStart);
+    else
+        writeHeader(out, static_cast<uint64_t>(-1 - value), negativeIntegerStart);
+}
+
+static void writeDateTime(WriterState &writer, OutputBuffer &out, const CborValue &value)
+{
+    char text[cborMaxDateTimeSize];
+    size_t size = cborFormatDateTime(*value.getIf<CborValue::DateTime>(), text);
+
+    out.put(static_cast<char>(textBasedDateTime));
+    writeHeader(out, size, utf8StringStart);
+    out.append(text, size);
+
+    if( writer.inNamespace && cborIsStringReferenceCandidate(size, writer.nextStringIndex) )
+        addNamespaceString(writer, CborValue(std::string(text, size)), size);
+}
+
+static void writeEpochTime(OutputBuffer &out, const CborValue &value)
+{
+    const CborValue::EpochTime &epochTime = *value.getIf<CborValue::EpochTime>();
+
+    out.put(static_cast<char>(epochBasedDateTime));
+
+    if( epochTime.integral )
+        writeInt64(out, epochTime.seconds);
+    else
+        writeDouble(out, CborValue(epochTime.realSeconds));
+}
+
+template<typename T>
+static void writeExponentMantissa(OutputBuffer &out, const CborValue &value, int tag)
+{
+    const T &data = *value.getIf<T>();
+
+    out.put(static_cast<char>(tag));
+    writeHeader(out, 2, arrayStart);
+    writeInt64(out, data.exponent);
+    writeInt64(out, data.mantissa);
+}
+
+static void writeRaw(WriterState &writer, OutputBuffer &out, const CborValue &value)
+{
+    const std::vector<char> &data = value.getIf<CborValue::Raw>()->data;
+
+    // Strings of the raw item must not take indexes of the document, so it
+    // gets a namespace of its own.
+    if( writer.inNamespace )
+        writeHeader(out, stringReferenceNamespace, taggedStart);
+
+    out.append(data.data(), data.size());
+}
+
+static bool isShareable(const CborValue &value)
+{
+    if( const std::vector<CborValue> *arr = value.getIf< std::vector<CborValue> >() )
+        return arr->empty() == false;
+
+    if( const std::map<CborValue, CborValue> *map = value.getIf< std::map<CborValue, CborValue> >() )
+        return map->empty() == false;
+
+    return false;
+}
+
+// Counts the occurrences of arrays and maps. A repeated item is not walked
+// again: its items are written once anyway.
+static void countSharedValues(WriterState::SharingTable &table, const CborValue &value)
+{
+    if( !isShareable(value) || ++table[value].count > 1 )
+        return;
+
+    if( const std::vector<CborValue> *arr = value.getIf< std::vector<CborValue> >() )
+    {
+        for(size_t i = 0; i < arr->size(); ++i)
+            countSharedValues(table, (*arr)[i]);
+    }
+    else
+    {
+        const std::map<CborValue, CborValue> &map = *value.getIf< std::map<CborValue, CborValue> >();
+        std::map<CborValue, CborValue>::const_iterator it = map.begin();
+
+        for(; it != map.end(); ++it)
+        {
+            countSharedValues(table, it->first);
+            countSharedValues(table, it->second);
+        }
     }
 }
 
-static void cborWriteInternal(std::vector<char> &buff, const CborValue &value)
+// Writes a reference to a repeated item which was written before, or marks
+// its first copy as shareable. Returns false if the item has to be written.
+static bool writeSharedReference(WriterState &writer, OutputBuffer &out, const CborValue &value)
 {
+    WriterState::SharingTable::iterator it = writer.sharedValues.find(value);
+
+    if( it == writer.sharedValues.end() || it->second.count < 2 )
+        return false;
+
+    WriterState::SharedEntry &entry = it->second;
+
+    if( entry.written )
+    {
+        writeHeader(out, sharedReference, taggedStart);
+        writeHeader(out, entry.index, positiveIntegerStart);
+        return true;
+    }
+
+    entry.written = true;
+    entry.index = writer.nextSharedIndex++;
+    writeHeader(out, shareable, taggedStart);
+    return false;
+}
+
+static void cborWriteInternal(WriterState &writer, OutputBuffer &out,
+                              const CborValue &value)
+{
+    if( writer.sharing && isShareable(value) && writeSharedReference(writer, out, value) )
+        return;
+
     switch(value.type())
     {
     case CborValue::NullType:
-        writeNull(buff);
+        writeNull(out);
         break;
     case CborValue::UndefinedType:
-        writeUndefined(buff);
+        writeUndefined(out);
         break;
     case CborValue::BoolType:
-        writeBool(buff, value);
+        writeBool(out, value);
         break;
     case CborValue::NegativeIntegerType:
-        writeNegativeInteger(buff, value);
+        writeNegativeInteger(out, value);
         break;
     case CborValue::PositiveIntegerType:
-        writePositiveInteger(buff, value);
+        writePositiveInteger(out, value);
         break;
     case CborValue::DoubleType:
-        writeDouble(buff, value);
+        writeDouble(out, value);
         break;
     case CborValue::StringType:
-        writeString(buff, value);
+        writeString(writer, out, value);
         break;
     case CborValue::ByteStringType:
-        writeByteString(buff, value);
+        writeByteString(writer, out, value);
         break;
     case CborValue::ArrayType:
-        writeArray(buff, value);
+        writeArray(writer, out, value);
         break;
     case CborValue::MapType:
-        writeMap(buff, value);
+        writeMap(writer, out, value);
         break;
     case CborValue::BigIntegerType:
-        writeBigInteger(buff, value);
+        writeBigInteger(writer, out, value);
+        break;
+    case CborValue::RawType:
+        writeRaw(writer, out, value);
+        break;
+    case CborValue::DateTimeType:
+        writeDateTime(writer, out, value);
+        break;
+    case CborValue::EpochTimeType:
+        writeEpochTime(out, value);
+        break;
+    case CborValue::DecimalFractionType:
+        writeExponentMantissa<CborValue::DecimalFraction>(out, value, decimalFraction);
+        break;
+    case CborValue::BigFloatType:
+        writeExponentMantissa<CborValue::BigFloat>(out, value, bigFloat);
         break;
     default:
         assert(false);
@@ -411,11 +738,104 @@ static void cborWriteInternal(std::vector<char> &buff, const CborValue &value)
     }
 }
 
+CborWriter::CborWriter()
+    : pimpl(new Impl())
+{
+}
+
+CborWriter::~CborWriter()
+{
+}
+
+bool CborWriter::isDeterministic() const
+{
+    return pimpl->deterministic;
+}
+
+void CborWriter::setDeterministic(bool deterministic)
+{
+    pimpl->deterministic = deterministic;
+}
+
+bool CborWriter::hasStringReferences() const
+{
+    return pimpl->stringReferences;
+}
+
+void CborWriter::setStringReferences(bool stringReferences)
+{
+    pimpl->stringReferences = stringReferences;
+}
+
+size_t CborWriter::threadsCount() const
+{
+    return pimpl->threadsCount;
+}
+
+void CborWriter::setThreadsCount(size_t threadsCount)
+{
+    pimpl->threadsCount = std::max<size_t>(threadsCount, 1);
+}
+
+bool CborWriter::hasValueSharing() const
+{
+    return pimpl->valueSharing;
+}
+
+void CborWriter::setValueSharing(bool valueSharing)
+{
+    pimpl->valueSharing = valueSharing;
+}
+
+void CborWriter::write(std::vector<char> &buff, const CborValue &value)
+{
+    if( pimpl->keyCache.size() > Impl::MaxCachedKeys )
+        pimpl->keyCache.clear();
+
+    OutputBuffer out(buff);
+
+    if( pimpl->stringReferences )
+    {
+        writeHeader(out, stringReferenceNamespace, taggedStart);
+        pimpl->inNamespace = true;
+    }
+
+    if( pimpl->valueSharing )
+    {
+        countSharedValues(pimpl->sharedValues, value);
+        pimpl->sharing = true;
+    }
+
+    cborWriteInternal(*pimpl, out, value);
+
+    // The tables are valid for one document only.
+    pimpl->inNamespace = false;
+    pimpl->strings.clear();
+    pimpl->nextStringIndex = 0;
+
+    pimpl->sharing = false;
+    pimpl->sharedValues.clear();
+    pimpl->nextSharedIndex = 0;
+}
+
+std::vector<char> CborWriter::write(const CborValue &value)
+{
+    std::vector<char> result;
+
+    write(result, value);
+    return result;
+}
+
 std::vector<char> cborWrite(const CborValue &value)
 {
     std::vector<char> result;
+    WriterState writer;
+
+    {
+        OutputBuffer out(result);
+        cborWriteInternal(writer, out, value);
+    }
 
-    cborWriteInternal(result, value);
     return result;
 }
 
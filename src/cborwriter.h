@@ -8,8 +8,56 @@
 
 #include <vector>
 
+#include <boost/scoped_ptr.hpp>
+
 #include "cborvalue.h"
 
 std::vector<char> cborWrite(const CborValue &value);
 
+// Long-lived encoder with options. It caches the encodings of map keys, so
+// keep one writer for documents which share their keys.
+class CborWriter {
+public:
+    CborWriter();
+    ~CborWriter();
+
+    // Deterministic encoding (RFC 8949, section 4.2.1): map keys are sorted
+    // by their encoded bytes instead of the CborValue order, so equal
+    // documents are encoded to equal bytes by any conforming encoder.
+    bool isDeterministic() const;
+    void setDeterministic(bool deterministic);
+
+    // Stringref compression (tag 256 and 25, http://cbor.schmorp.de/stringref):
+    // every document becomes a string namespace and a repeated string is sent
+    // as a reference to its first occurrence. The decoder must support the
+    // extension; CborDecoder returns such strings shared.
+    bool hasStringReferences() const;
+    void setStringReferences(bool stringReferences);
+
+    // Value sharing (tag 28 and 29, http://cbor.schmorp.de/value-sharing):
+    // an array or a map which occurs more than once in a document is written
+    // once, the other copies refer to it. CborDecoder returns them as one
+    // shared value. Raw values must not contain these tags themselves.
+    bool hasValueSharing() const;
+    void setValueSharing(bool valueSharing);
+
+    // Arrays and maps with many items are encoded by threadsCount threads
+    // into separate buffers which are joined in order; the output is the same
+    // as with one thread. Not used together with string references or value
+    // sharing, which number the items in document order.
+    size_t threadsCount() const;
+    void setThreadsCount(size_t threadsCount);
+
+    // Appends the encoded value to buff.
+    void write(std::vector<char> &buff, const CborValue &value);
+    std::vector<char> write(const CborValue &value);
+
+private:
+    CborWriter(const CborWriter &);
+    CborWriter &operator = (const CborWriter &);
+
+    class Impl;
+    boost::scoped_ptr<Impl> pimpl;
+};
+
 #endif // CBORWRITER_H
@@ -4,6 +4,13 @@
 #include <stdio.h>
 #include <boost/test/unit_test.hpp>
 #include <math.h>
+#include <unordered_set>
+#include <thread>
+#include <sstream>
+#include <limits>
+
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "../src/cborcpp.h"
 #include "../src/cborvalue.h"
@@ -488,3 +495,1563 @@ BOOST_AUTO_TEST_CASE( Interface )
         BOOST_CHECK(it.value() == CborValue("B"));
     }
 }
+
+BOOST_AUTO_TEST_CASE( NestingDepth )
+{
+    {
+        // [[[...[1]...]]] nested 10000 levels deep
+        std::vector<char> data(10000, static_cast<char>(0x81));
+        data.push_back(0x01);
+
+        CborValue value = cborRead(data, data.size());
+        size_t depth = 0;
+
+        while( value.isArray() )
+        {
+            CborValue item = value.at(0);
+            value = item;
+            ++depth;
+        }
+
+        BOOST_CHECK_EQUAL(depth, 10000u);
+        BOOST_CHECK_EQUAL(value, CborValue(1));
+
+        BOOST_CHECK(cborRead(data).isNull());
+        BOOST_CHECK(cborRead(data, 9999).isNull());
+    }
+
+    // Malformed input is rejected without crashing.
+    BOOST_CHECK(decode(toVector("\x9b\xff\xff\xff\xff\xff\xff\xff\xff\x01")).isNull());
+    BOOST_CHECK(decode(toVector("\x83\x01\x02")).isNull());
+    BOOST_CHECK(decode(toVector("\xa1\x01")).isNull());
+    BOOST_CHECK(decode(toVector("\x65\x61\x62")).isNull());
+    BOOST_CHECK(decode(toVector("\x9f\x01\xff")).isNull());
+    BOOST_CHECK(decode(toVector("\xc2\x01")).isNull());
+    BOOST_CHECK(decode(toVector("\xfc")).isNull());
+}
+
+BOOST_AUTO_TEST_CASE( BatchRead )
+{
+    std::vector< std::vector<char> > buffers;
+    std::vector<char> data;
+    std::vector<size_t> offsets;
+
+    for(int i = 0; i < 1000; ++i)
+    {
+        std::vector<CborValue> arr;
+
+        arr.push_back(i);
+        arr.push_back("item");
+
+        std::vector<char> encoded = encode(arr);
+
+        offsets.push_back(data.size());
+        data.insert(data.end(), encoded.begin(), encoded.end());
+        buffers.push_back(encoded);
+    }
+
+    buffers[500] = toVector("\x83\x01");
+
+    std::vector<CborValue> results;
+
+    for(size_t threads = 1; threads <= 4; threads += 3)
+    {
+        BOOST_CHECK_EQUAL(cborReadBatch(buffers, results, threads), 999u);
+        BOOST_CHECK_EQUAL(results.size(), 1000u);
+        BOOST_CHECK(results[500].isNull());
+        BOOST_CHECK_EQUAL(results[999].at(0), CborValue(999));
+
+        BOOST_CHECK_EQUAL(cborReadBatch(data, offsets, results, threads), 1000u);
+        BOOST_CHECK_EQUAL(results[500].at(0), CborValue(500));
+        BOOST_CHECK_EQUAL(results[999].at(1), CborValue("item"));
+    }
+}
+
+BOOST_AUTO_TEST_CASE( ReusableDecoder )
+{
+    std::map<CborValue, CborValue> map;
+    std::vector<CborValue> arr;
+
+    arr.push_back("a rather long string which does not fit into a small string buffer");
+    arr.push_back(std::vector<char>(100, 'x'));
+    arr.push_back(std::vector<CborValue>(3, CborValue(7)));
+    map[CborValue("array")] = arr;
+    map[CborValue(1)] = CborValue(true);
+
+    std::vector<char> data = encode(map);
+    CborDecoder decoder;
+
+    for(int i = 0; i < 3; ++i)
+    {
+        CborValue value = decoder.read(data);
+
+        BOOST_CHECK_EQUAL(value, CborValue(map));
+
+        decoder.recycle(value);
+        BOOST_CHECK(value.isNull());
+    }
+
+    // Duplicate keys decoded through recycled map nodes: the last value wins.
+    CborValue value;
+
+    BOOST_CHECK(decoder.read(data.data(), data.size(), value));
+    decoder.recycle(value);
+    BOOST_CHECK(decoder.read("\xa2\x01\x02\x01\x03", 5, value));
+    BOOST_CHECK_EQUAL(value.size(), 1u);
+    BOOST_CHECK_EQUAL(value.member(1), CborValue(3));
+
+    BOOST_CHECK(decoder.read("\x82\x01", 2, value) == false);
+    BOOST_CHECK(value.isNull());
+}
+
+BOOST_AUTO_TEST_CASE( DeterministicEncoding )
+{
+    std::map<CborValue, CborValue> map;
+    std::vector<CborValue> arrayKey(1, CborValue(1));
+
+    map[CborValue("aa")] = CborValue(1);
+    map[CborValue("b")] = CborValue(2);
+    map[CborValue(false)] = CborValue(3);
+    map[CborValue(10)] = CborValue(4);
+    map[CborValue(-1)] = CborValue(5);
+    map[CborValue(arrayKey)] = CborValue(6);
+
+    // {10: 4, -1: 5, "b": 2, "aa": 1, [1]: 6, false: 3}
+    std::vector<char> expected = toVector("\xa6\x0a\x04\x20\x05\x61\x62\x02\x62\x61\x61\x01"
+                                          "\x81\x01\x06\xf4\x03");
+    CborWriter writer;
+
+    BOOST_CHECK(writer.isDeterministic() == false);
+    BOOST_CHECK(writer.write(map) == encode(map));
+
+    writer.setDeterministic(true);
+    BOOST_CHECK(writer.write(map) == expected);
+    // The second pass uses the cached keys.
+    BOOST_CHECK(writer.write(map) == expected);
+    BOOST_CHECK_EQUAL(decode(expected), CborValue(map));
+}
+
+BOOST_AUTO_TEST_CASE( RawValues )
+{
+    std::vector<char> encoded = toVector("\x82\x61\x61\xa1\x61\x62\x61\x63");
+
+    BOOST_CHECK_EQUAL(cborItemSize(encoded.data(), encoded.size()), encoded.size());
+    BOOST_CHECK_EQUAL(cborItemSize(encoded.data(), encoded.size() - 1), 0u);
+    BOOST_CHECK_EQUAL(cborItemSize("\x9b\xff\xff\xff\xff\xff\xff\xff\xff", 9), 0u);
+
+    CborValue raw = CborValue::raw(encoded);
+
+    BOOST_CHECK(raw.isRaw());
+    BOOST_CHECK(raw.toRaw() == encoded);
+    BOOST_CHECK(encode(raw) == encoded);
+    BOOST_CHECK_THROW(CborValue::raw(toVector("\x82\x01")), std::runtime_error);
+    BOOST_CHECK_THROW(CborValue::raw(toVector("\x01\x02")), std::runtime_error);
+
+    std::vector<CborValue> arr;
+    arr.push_back(1);
+    arr.push_back(raw);
+    BOOST_CHECK(encode(arr) == toVector("\x82\x01\x82\x61\x61\xa1\x61\x62\x61\x63"));
+
+    // {"a": [1, {"b": "c"}], "b": [1, 2]}
+    std::vector<char> document = toVector("\xa2\x61\x61\x82\x01\xa1\x61\x62\x61\x63"
+                                          "\x61\x62\x82\x01\x02");
+    CborDecoder decoder;
+    CborPath path;
+
+    path.push_back("a");
+    path.push_back(1);
+    decoder.addRawPath(path);
+
+    CborValue value = decoder.read(document);
+
+    BOOST_CHECK(value.member("a").at(0) == CborValue(1));
+    BOOST_CHECK(value.member("a").at(1) == CborValue::raw(toVector("\xa1\x61\x62\x61\x63")));
+    BOOST_CHECK(value.member("b").at(1) == CborValue(2));
+    BOOST_CHECK(encode(value) == document);
+
+    decoder.clearRawPaths();
+    decoder.addRawPath(CborPath());
+    BOOST_CHECK(decoder.read(document) == CborValue::raw(document));
+}
+
+BOOST_AUTO_TEST_CASE( Hashing )
+{
+    std::map<CborValue, CborValue> map;
+    std::vector<CborValue> arr;
+
+    arr.push_back(1);
+    arr.push_back("two");
+    arr.push_back(3.5);
+    map[CborValue("a")] = arr;
+    map[CborValue(-1)] = std::vector<char>(20, 'x');
+
+    CborValue value(map);
+    CborValue copy = decode(encode(value));
+
+    BOOST_CHECK_EQUAL(value.hash(), copy.hash());
+    BOOST_CHECK_EQUAL(value.hash(), std::hash<CborValue>()(copy));
+    BOOST_CHECK_EQUAL(value.hash(42), copy.hash(42));
+    BOOST_CHECK(value.hash() != value.hash(42));
+    BOOST_CHECK(value == copy);
+
+    BOOST_CHECK(CborValue(0.0).hash() == CborValue(-0.0).hash());
+    BOOST_CHECK(CborValue(1).hash() != CborValue(-1).hash());
+    BOOST_CHECK(CborValue("ab").hash() != CborValue(std::vector<char>(toVector("ab"))).hash());
+    BOOST_CHECK(CborValue("abcdefghijklmnopq").hash() != CborValue("abcdefghijklmnopr").hash());
+
+    arr.push_back(4);
+    BOOST_CHECK(CborValue(arr).hash() != value.member("a").hash());
+    BOOST_CHECK(CborValue(arr) != value.member("a"));
+
+    std::unordered_set<CborValue> set;
+
+    set.insert(value);
+    set.insert(copy);
+    set.insert(CborValue(arr));
+    set.insert(CborValue("key"));
+    set.insert(CborValue("key"));
+    BOOST_CHECK_EQUAL(set.size(), 3u);
+    BOOST_CHECK(set.count(decode(encode(arr))) == 1);
+}
+
+BOOST_AUTO_TEST_CASE( SharedValues )
+{
+    std::vector<CborValue> items;
+    items.push_back(CborValue(std::string(100, 'x')));
+    items.push_back(CborValue(1));
+
+    CborValue array(items);
+    CborValue copy = array;
+
+    BOOST_CHECK(copy == array);
+
+    copy.append(CborValue(2));
+    BOOST_CHECK_EQUAL(array.toArray().size(), 2u);
+    BOOST_CHECK_EQUAL(copy.toArray().size(), 3u);
+    BOOST_CHECK_EQUAL(copy.at(2).toPositiveInteger(), 2u);
+
+    copy.setAt(0, CborValue("y"));
+    BOOST_CHECK_EQUAL(copy.at(0).toString(), "y");
+    BOOST_CHECK_EQUAL(array.at(0).toString(), std::string(100, 'x'));
+    BOOST_CHECK_THROW(copy.setAt(3, CborValue(0)), std::out_of_range);
+
+    // A value appended to itself is its old state.
+    CborValue self = array;
+    self.append(self);
+    BOOST_CHECK_EQUAL(self.toArray().size(), 3u);
+    BOOST_CHECK(self.at(2) == array);
+
+    std::map<CborValue, CborValue> members;
+    members[CborValue("a")] = array;
+
+    CborValue map(members);
+    CborValue mapCopy = map;
+    size_t hash = map.hash();
+
+    mapCopy.setMember(CborValue("b"), CborValue(true));
+    BOOST_CHECK(map.hasMember("b") == false);
+    BOOST_CHECK(mapCopy.member("b").toBool());
+    BOOST_CHECK(mapCopy.hash() != hash);
+
+    BOOST_CHECK(mapCopy.removeMember(CborValue("b")));
+    BOOST_CHECK(mapCopy.removeMember(CborValue("b")) == false);
+    BOOST_CHECK(mapCopy == map);
+    BOOST_CHECK_EQUAL(mapCopy.hash(), hash);
+
+    BOOST_CHECK_THROW(array.setMember(CborValue("a"), CborValue(1)), std::runtime_error);
+    BOOST_CHECK_THROW(map.append(CborValue(1)), std::runtime_error);
+
+    // Moved-from values stay valid and read as empty.
+    CborValue string("moved");
+    CborValue movedString(std::move(string));
+    CborValue movedArray(std::move(copy));
+    CborValue movedMap = std::move(mapCopy);
+
+    BOOST_CHECK_EQUAL(movedString.toString(), "moved");
+    BOOST_CHECK_EQUAL(string.toString(), "");
+    BOOST_CHECK(string == CborValue(""));
+    BOOST_CHECK(string < movedString);
+    BOOST_CHECK(string.hash() == CborValue("").hash());
+    BOOST_CHECK(copy.isArray() && copy.isEmpty());
+    BOOST_CHECK(mapCopy.isMap() && mapCopy.find(CborValue("a")) == 0);
+    BOOST_CHECK_EQUAL(string.memoryUsage(), 0u);
+
+    copy.append(CborValue(1));
+    mapCopy.setMember(CborValue("c"), CborValue(2));
+    string = CborValue("again");
+    BOOST_CHECK_EQUAL(copy.size(), 1u);
+    BOOST_CHECK_EQUAL(mapCopy.member("c").toPositiveInteger(), 2u);
+    BOOST_CHECK_EQUAL(string.toString(), "again");
+    BOOST_CHECK_EQUAL(movedArray.size(), 3u);
+    BOOST_CHECK(movedMap == map);
+
+    // Recycling a decoded value must not disturb its copies.
+    CborDecoder decoder;
+    std::vector<char> data = cborWrite(map);
+    CborValue decoded = decoder.read(data);
+    CborValue kept = decoded;
+
+    decoder.recycle(decoded);
+    decoded = decoder.read(data);
+    BOOST_CHECK(kept == map);
+    BOOST_CHECK(decoded == map);
+}
+
+BOOST_AUTO_TEST_CASE( NonThrowingAccessors )
+{
+    std::map<CborValue, CborValue> members;
+    members[CborValue("name")] = CborValue("value");
+    members[CborValue(1)] = CborValue(2.5);
+
+    CborValue map(members);
+
+    BOOST_REQUIRE(map.find("name") != 0);
+    BOOST_CHECK_EQUAL(map.find("name")->toString(), "value");
+    BOOST_REQUIRE(map.find(1) != 0);
+    BOOST_CHECK_EQUAL(*map.find(1)->getIf<double>(), 2.5);
+    BOOST_CHECK(map.find("missing") == 0);
+    BOOST_CHECK(CborValue(1).find("name") == 0);
+
+    BOOST_CHECK((map.getIf< std::map<CborValue, CborValue> >() != 0));
+    BOOST_CHECK(map.getIf< std::vector<CborValue> >() == 0);
+    BOOST_CHECK(map.getIf<std::string>() == 0);
+    BOOST_CHECK_EQUAL(*CborValue("abc").getIf<std::string>(), "abc");
+    BOOST_CHECK_EQUAL(*CborValue(true).getIf<bool>(), true);
+    BOOST_CHECK(CborValue(true).getIf<double>() == 0);
+
+    BOOST_CHECK(CborValue(std::numeric_limits<int64_t>::max()).tryToInt64() ==
+                std::numeric_limits<int64_t>::max());
+    BOOST_CHECK(CborValue(std::numeric_limits<int64_t>::min() + 1).tryToInt64() ==
+                std::numeric_limits<int64_t>::min() + 1);
+    BOOST_CHECK(CborValue(uint64_t(0x8000000000000000ULL), false).tryToInt64() ==
+                std::numeric_limits<int64_t>::min());
+    BOOST_CHECK(CborValue(-1).tryToInt64() == int64_t(-1));
+    BOOST_CHECK(CborValue(0).tryToInt64() == int64_t(0));
+    BOOST_CHECK(!CborValue(uint64_t(0x8000000000000000ULL)).tryToInt64());
+    BOOST_CHECK(!CborValue(uint64_t(0x8000000000000001ULL), false).tryToInt64());
+    BOOST_CHECK(!CborValue("1").tryToInt64());
+
+    BOOST_CHECK(map.hasMember("missing") == false);
+    BOOST_CHECK_THROW(map.member("missing"), std::runtime_error);
+    BOOST_CHECK_THROW(CborValue(1).hasMember("name"), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE( RangeIterators )
+{
+    std::vector<CborValue> items;
+    for(int i = 0; i < 5; ++i)
+        items.push_back(CborValue(i));
+
+    CborValue array(items);
+    size_t index = 0;
+
+    for(const CborValue &item : array.arrayItems())
+    {
+        BOOST_CHECK_EQUAL(item.toPositiveInteger(), index);
+        BOOST_CHECK(&item == &(*array.getIf< std::vector<CborValue> >())[index]);
+        ++index;
+    }
+
+    BOOST_CHECK_EQUAL(index, items.size());
+
+    std::map<CborValue, CborValue> members;
+    members[CborValue("a")] = CborValue(1);
+    members[CborValue("b")] = CborValue(array);
+
+    CborValue map(members);
+    std::vector<std::string> keys;
+
+    for(const auto &member : map.mapItems())
+    {
+        keys.push_back(member.first.toString());
+        BOOST_CHECK(&member.second == map.find(member.first));
+    }
+
+    BOOST_REQUIRE_EQUAL(keys.size(), 2u);
+    BOOST_CHECK_EQUAL(keys[0], "a");
+    BOOST_CHECK_EQUAL(keys[1], "b");
+
+    // The range keeps a temporary value alive.
+    size_t count = 0;
+    for(const CborValue &item : cborRead(cborWrite(array)).arrayItems())
+        count += item.toPositiveInteger();
+    BOOST_CHECK_EQUAL(count, 10u);
+
+    BOOST_CHECK(CborValue(std::vector<CborValue>()).arrayItems().empty());
+    BOOST_CHECK_THROW(map.arrayItems(), std::runtime_error);
+    BOOST_CHECK_THROW(array.mapItems(), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE( IntegerHeaders )
+{
+    const uint64_t values[] = {
+        0, 23, 24, 255, 256, 65535, 65536, 4294967295ULL, 4294967296ULL,
+        0xffffffffffffffffULL
+    };
+    const size_t sizes[] = {1, 1, 2, 2, 3, 3, 5, 5, 9, 9};
+
+    for(size_t i = 0; i < sizeof(values) / sizeof(values[0]); ++i)
+    {
+        std::vector<char> positive = cborWrite(CborValue(values[i]));
+        BOOST_CHECK_EQUAL(positive.size(), sizes[i]);
+        BOOST_CHECK_EQUAL(cborRead(positive).toPositiveInteger(), values[i]);
+
+        std::vector<char> array = cborWrite(CborValue(std::vector<CborValue>(values[i] % 300, CborValue(1))));
+        BOOST_CHECK_EQUAL(cborRead(array).size(), values[i] % 300);
+    }
+
+    std::vector<char> data = cborWrite(CborValue(uint64_t(0x0102030405060708ULL)));
+    const char expected[] = {0x1b, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08};
+
+    BOOST_CHECK_EQUAL_COLLECTIONS(data.begin(), data.end(), expected, expected + sizeof(expected));
+
+    data = cborWrite(CborValue(-500));
+    const char negative[] = {0x39, 0x01, static_cast<char>(0xf3)};
+
+    BOOST_CHECK_EQUAL_COLLECTIONS(data.begin(), data.end(), negative, negative + sizeof(negative));
+}
+
+BOOST_AUTO_TEST_CASE( InitialBytes )
+{
+    // Every argument width, with and without enough data.
+    const char oneByte[] = {0x18, 0x2a};
+    const char twoBytes[] = {0x39, 0x01, 0x00};
+    const char fourBytes[] = {0x1a, 0x00, 0x01, 0x00, 0x00};
+    const char eightBytes[] = {0x1b, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00};
+
+    BOOST_CHECK_EQUAL(cborRead(std::vector<char>(oneByte, oneByte + 2)).toPositiveInteger(), 42u);
+    BOOST_CHECK_EQUAL(cborRead(std::vector<char>(twoBytes, twoBytes + 3)).toNegativeInteger(), 257u);
+    BOOST_CHECK_EQUAL(cborRead(std::vector<char>(fourBytes, fourBytes + 5)).toPositiveInteger(), 65536u);
+    BOOST_CHECK_EQUAL(cborRead(std::vector<char>(eightBytes, eightBytes + 9)).toPositiveInteger(), 4294967296ULL);
+
+    BOOST_CHECK(cborRead(std::vector<char>(oneByte, oneByte + 1)).isNull());
+    BOOST_CHECK(cborRead(std::vector<char>(twoBytes, twoBytes + 2)).isNull());
+    BOOST_CHECK(cborRead(std::vector<char>(fourBytes, fourBytes + 4)).isNull());
+    BOOST_CHECK(cborRead(std::vector<char>(eightBytes, eightBytes + 8)).isNull());
+
+    // An argument followed by more data is read with a wide load.
+    std::vector<CborValue> items;
+    items.push_back(CborValue(uint64_t(300)));
+    items.push_back(CborValue("x"));
+    items.push_back(CborValue(1.5));
+    items.push_back(CborValue(1.1));
+    items.push_back(CborValue(false));
+    items.push_back(CborValue::undefiend());
+
+    BOOST_CHECK(cborRead(cborWrite(items)) == CborValue(items));
+
+    // Reserved additional information, indefinite lengths and break.
+    const char invalid[] = {0x1c, 0x3d, 0x5e, 0x5f, 0x7f, static_cast<char>(0x9f),
+                            static_cast<char>(0xbf), static_cast<char>(0xdf),
+                            static_cast<char>(0xfc), static_cast<char>(0xff)};
+
+    for(size_t i = 0; i < sizeof(invalid); ++i)
+    {
+        std::vector<char> data(1, invalid[i]);
+        data.resize(16, 0);
+
+        BOOST_CHECK(cborRead(data).isNull());
+        BOOST_CHECK_EQUAL(cborItemSize(data.data(), data.size()), 0u);
+    }
+
+    const char half[] = {static_cast<char>(0xf9), 0x3c, 0x00};
+    BOOST_CHECK_EQUAL(cborRead(std::vector<char>(half, half + 3)).toDouble(), 1.0);
+}
+
+BOOST_AUTO_TEST_CASE( InlineBigNumbers )
+{
+    for(size_t size = 9; size <= 20; ++size)
+    {
+        CborValue::BigInteger bigInteger;
+
+        bigInteger.positive = size % 2 == 0;
+        bigInteger.bigint.resize(size);
+
+        for(size_t i = 0; i < size; ++i)
+            bigInteger.bigint[i] = static_cast<char>(0x80 + i);
+
+        CborValue value(bigInteger);
+        std::vector<char> data = cborWrite(value);
+
+        BOOST_CHECK_EQUAL(data.size(), 2 + size);
+        BOOST_CHECK(cborRead(data) == value);
+
+        CborValue::BigInteger copy = bigInteger;
+        BOOST_CHECK(copy == bigInteger);
+
+        CborValue::BigInteger moved = std::move(copy);
+        BOOST_CHECK(moved == bigInteger);
+        BOOST_CHECK(copy.bigint.empty());
+
+        std::vector<char> bytes = moved.bigint;
+        BOOST_CHECK_EQUAL(bytes.size(), size);
+        BOOST_CHECK(CborSmallBytes(bytes) == bigInteger.bigint);
+    }
+
+    // -(0xffff...ff) - 1 needs one more byte than its encoding.
+    const char encoded[] = "\xc3\x4a\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff";
+    CborValue value = cborRead(std::vector<char>(encoded, encoded + sizeof(encoded) - 1));
+
+    BOOST_REQUIRE(value.isBigInteger());
+    BOOST_REQUIRE_EQUAL(value.toBigInteger().bigint.size(), 11u);
+    BOOST_CHECK_EQUAL(value.toBigInteger().bigint[0], 1);
+    BOOST_CHECK(cborWrite(value) == std::vector<char>(encoded, encoded + sizeof(encoded) - 1));
+
+    CborSmallBytes small(std::vector<char>(3, 'a'));
+    CborSmallBytes large(std::vector<char>(30, 'a'));
+
+    BOOST_CHECK(small < large);
+    BOOST_CHECK(!(large < small));
+    large.resize(3);
+    BOOST_CHECK(small == large);
+}
+
+BOOST_AUTO_TEST_CASE( TimeAndFractionTags )
+{
+    // RFC 8949 appendix A examples.
+    CborValue dateTime = decode(toVector("\xc0\x74" "2013-03-21T20:04:00Z"));
+
+    BOOST_REQUIRE(dateTime.isDateTime());
+    BOOST_CHECK_EQUAL(dateTime.toDateTime().seconds, 1363896240);
+    BOOST_CHECK_EQUAL(dateTime.toDateTime().nanoseconds, 0u);
+    BOOST_CHECK(encode(dateTime) == toVector("\xc0\x74" "2013-03-21T20:04:00Z"));
+
+    CborValue epoch = decode(toVector("\xc1\x1a\x51\x4b\x67\xb0"));
+
+    BOOST_REQUIRE(epoch.isEpochTime());
+    BOOST_CHECK(epoch.toEpochTime().integral);
+    BOOST_CHECK_EQUAL(epoch.toEpochTime().seconds, 1363896240);
+    BOOST_CHECK(encode(epoch) == toVector("\xc1\x1a\x51\x4b\x67\xb0"));
+
+    CborValue realEpoch = decode(toVector("\xc1\xfb\x41\xd4\x52\xd9\xec\x20\x00\x00"));
+
+    BOOST_REQUIRE(realEpoch.isEpochTime());
+    BOOST_CHECK(realEpoch.toEpochTime().integral == false);
+    BOOST_CHECK_EQUAL(realEpoch.toEpochTime().realSeconds, 1363896240.5);
+    BOOST_CHECK(encode(realEpoch) == toVector("\xc1\xfb\x41\xd4\x52\xd9\xec\x20\x00\x00"));
+
+    CborValue fraction = decode(toVector("\xc4\x82\x21\x19\x6a\xb3"));
+
+    BOOST_REQUIRE(fraction.isDecimalFraction());
+    BOOST_CHECK_EQUAL(fraction.toDecimalFraction().exponent, -2);
+    BOOST_CHECK_EQUAL(fraction.toDecimalFraction().mantissa, 27315);
+    BOOST_CHECK(encode(fraction) == toVector("\xc4\x82\x21\x19\x6a\xb3"));
+
+    CborValue bigFloat = decode(toVector("\xc5\x82\x20\x03"));
+
+    BOOST_REQUIRE(bigFloat.isBigFloat());
+    BOOST_CHECK_EQUAL(bigFloat.toBigFloat().exponent, -1);
+    BOOST_CHECK_EQUAL(bigFloat.toBigFloat().mantissa, 3);
+    BOOST_CHECK(encode(bigFloat) == toVector("\xc5\x82\x20\x03"));
+    BOOST_CHECK(bigFloat != fraction);
+
+    // Offsets, fractions and leap years.
+    CborValue::DateTime parsed = CborValue::dateTime("2024-02-29T23:30:00.25+01:30").toDateTime();
+
+    BOOST_CHECK_EQUAL(parsed.seconds, 1709244000); // 2024-02-29T22:00:00Z
+    BOOST_CHECK_EQUAL(parsed.nanoseconds, 250000000u);
+    BOOST_CHECK_EQUAL(parsed.utcOffset, 90);
+    BOOST_CHECK_EQUAL(CborValue(parsed).inspect(), "0(\"2024-02-29T23:30:00.25+01:30\")");
+    BOOST_CHECK(CborValue::dateTime("1969-12-31T23:59:59Z").toDateTime().seconds == -1);
+
+    BOOST_CHECK_THROW(CborValue::dateTime("2023-02-29T00:00:00Z"), std::runtime_error);
+    BOOST_CHECK_THROW(CborValue::dateTime("2023-01-01T24:00:00Z"), std::runtime_error);
+    BOOST_CHECK_THROW(CborValue::dateTime("2023-01-01T00:00:00"), std::runtime_error);
+    BOOST_CHECK_THROW(CborValue::dateTime("2023-01-01T00:00:00.Z"), std::runtime_error);
+    BOOST_CHECK_THROW(CborValue::dateTime("9999-12-31T23:59:60Z"), std::runtime_error);
+
+    // The value is the instant, not the text.
+    BOOST_CHECK_EQUAL(CborValue::dateTime("2024-01-01T00:00:00.500Z").inspect(),
+                      "0(\"2024-01-01T00:00:00.5Z\")");
+    BOOST_CHECK_EQUAL(CborValue::dateTime("2016-12-31T23:59:60Z").inspect(),
+                      "0(\"2017-01-01T00:00:00Z\")");
+
+    // Years 0000 to 9999 in the local time, nothing is rewritten to fit.
+    CborValue::DateTime bound = {253402300799LL, 999999999, 0};
+
+    BOOST_CHECK_EQUAL(CborValue(bound).inspect(), "0(\"9999-12-31T23:59:59.999999999Z\")");
+    bound.seconds = -62167219200LL - 3600;
+    bound.nanoseconds = 0;
+    bound.utcOffset = 60;
+    BOOST_CHECK_EQUAL(CborValue(bound).inspect(), "0(\"0000-01-01T00:00:00+01:00\")");
+
+    CborValue::DateTime invalid[] = {
+        {0, 1000000000, 0},
+        {0, 2000000000, 0},
+        {0, 0, 24 * 60},
+        {253402300800LL, 0, 0},
+        {253402300799LL, 0, 1},
+        {-62167219201LL, 0, 0},
+        {std::numeric_limits<int64_t>::max(), 0, 60},
+        {std::numeric_limits<int64_t>::min(), 0, -60}
+    };
+
+    for(size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); ++i)
+        BOOST_CHECK_THROW(CborValue value(invalid[i]), std::runtime_error);
+
+    // Bignum mantissas are not supported.
+    BOOST_CHECK(decode(toVector("\xc4\x82\x21\xc2\x41\x01")).isNull());
+    BOOST_CHECK(decode(toVector("\xc0\x01")).isNull());
+}
+
+BOOST_AUTO_TEST_CASE( StringReferences )
+{
+    // The example of http://cbor.schmorp.de/stringref
+    std::vector<char> example = toVector(
+        "\xd9\x01\x00\x83"
+        "\xa3\x64rank\x04\x65" "count\x19\x01\xa1\x64name\x68" "Cocktail"
+        "\xa3\xd8\x19\x02\x64" "Bath\xd8\x19\x01\x19\x01\x38\xd8\x19\x00\x04"
+        "\xa3\xd8\x19\x02\x64" "Food\xd8\x19\x01\x19\x08\x59\xd8\x19\x00\x04");
+
+    CborValue decoded = decode(example);
+
+    BOOST_REQUIRE(decoded.isArray());
+    BOOST_CHECK_EQUAL(decoded.at(1).member("name").toString(), "Bath");
+    BOOST_CHECK_EQUAL(decoded.at(2).member("count").toPositiveInteger(), 2137u);
+    BOOST_CHECK_EQUAL(decoded.at(2).member("rank").toPositiveInteger(), 4u);
+
+    // References resolve to the same storage.
+    BOOST_CHECK(decoded.at(0).mapItems().begin()->first.getIf<std::string>() ==
+                decoded.at(2).mapItems().begin()->first.getIf<std::string>());
+
+    std::vector<CborValue> items;
+    items.push_back(CborValue("hello"));
+    items.push_back(CborValue("hello"));
+    items.push_back(CborValue("hi"));
+    items.push_back(CborValue("hi"));
+    items.push_back(CborValue(toVector("hello")));
+    items.push_back(CborValue(toVector("hello")));
+
+    CborWriter writer;
+    BOOST_CHECK(writer.hasStringReferences() == false);
+
+    writer.setStringReferences(true);
+
+    std::vector<char> encoded = writer.write(CborValue(items));
+
+    BOOST_CHECK(encoded == toVector("\xd9\x01\x00\x86\x65hello\xd8\x19\x00\x62hi\x62hi"
+                                    "\x45hello\xd8\x19\x01"));
+    BOOST_CHECK_EQUAL(decode(encoded), CborValue(items));
+
+    // Every document starts a new table.
+    BOOST_CHECK(writer.write(CborValue(items)) == encoded);
+
+    // Deterministic keys, tagged strings and raw items inside a namespace.
+    std::map<CborValue, CborValue> map;
+    std::vector<CborValue> values;
+    CborValue::BigInteger bigInteger;
+
+    bigInteger.positive = true;
+    bigInteger.bigint = std::vector<char>(20, '\x01');
+
+    values.push_back(CborValue::dateTime("2013-03-21T20:04:00Z"));
+    values.push_back(CborValue(bigInteger));
+    values.push_back(CborValue::raw(toVector("\x82\x65hello\x65hello")));
+    values.push_back(CborValue("2013-03-21T20:04:00Z"));
+    values.push_back(CborValue("value"));
+    map[CborValue("value")] = CborValue(values);
+    map[CborValue("other")] = CborValue("value");
+
+    writer.setDeterministic(true);
+    encoded = writer.write(CborValue(map));
+
+    // The raw item is decoded as any other one.
+    CborValue roundTrip = decode(encoded);
+    CborValue expected(map);
+
+    CborValue expectedValues = expected.member("value");
+
+    expectedValues.setAt(2, cborRead(values[2].toRaw()));
+    expected.setMember(CborValue("value"), expectedValues);
+
+    BOOST_CHECK_EQUAL(roundTrip, expected);
+    BOOST_CHECK(encoded.size() < cborWrite(CborValue(map)).size());
+
+    CborDecoder rawDecoder;
+    CborPath rawPath;
+
+    rawPath.push_back(CborValue("value"));
+    rawPath.push_back(CborValue(2));
+    rawDecoder.addRawPath(rawPath);
+    BOOST_CHECK(rawDecoder.read(encoded).member("value").at(2).isRaw());
+    BOOST_CHECK(rawDecoder.read(example).isNull() == false);
+
+    // Invalid references.
+    BOOST_CHECK(decode(toVector("\xd8\x19\x00")).isNull());
+    BOOST_CHECK(decode(toVector("\xd9\x01\x00\x82\x62hi\xd8\x19\x00")).isNull());
+    BOOST_CHECK(decode(toVector("\xd9\x01\x00\x82\x63\x61\x62\x63\xd8\x19\x01")).isNull());
+    BOOST_CHECK(decode(toVector("\x82\xd9\x01\x00\x63\x61\x62\x63\xd8\x19\x00")).isNull());
+}
+
+BOOST_AUTO_TEST_CASE( ValueSharing )
+{
+    std::vector<CborValue> config;
+    config.push_back(CborValue("host"));
+    config.push_back(CborValue(8080));
+
+    std::map<CborValue, CborValue> block;
+    block[CborValue("config")] = CborValue(config);
+
+    // Equal but separately built items are shared as well.
+    std::vector<CborValue> items;
+    items.push_back(CborValue(block));
+    items.push_back(CborValue(block));
+    items.push_back(CborValue(config));
+    items.push_back(CborValue(std::vector<CborValue>(config)));
+
+    CborWriter writer;
+    BOOST_CHECK(writer.hasValueSharing() == false);
+
+    writer.setValueSharing(true);
+
+    // [28({"config": 28(["host", 8080])}), 29(0), 29(1), 29(1)]
+    std::vector<char> encoded = writer.write(CborValue(items));
+
+    BOOST_CHECK(encoded == toVector("\x84\xd8\x1c\xa1\x66" "config\xd8\x1c\x82\x64host\x19\x1f\x90"
+                                    "\xd8\x1d\x00\xd8\x1d\x01\xd8\x1d\x01"));
+
+    CborValue decoded = decode(encoded);
+
+    BOOST_CHECK_EQUAL(decoded, CborValue(items));
+    BOOST_CHECK(decoded.at(2).getIf< std::vector<CborValue> >() ==
+                decoded.at(0).member("config").getIf< std::vector<CborValue> >());
+    BOOST_CHECK((decoded.at(1).getIf< std::map<CborValue, CborValue> >() ==
+                 decoded.at(0).getIf< std::map<CborValue, CborValue> >()));
+
+    // Shared values stay independent for the mutators.
+    CborValue second = decoded.at(1);
+    second.setMember(CborValue("config"), CborValue(1));
+    BOOST_CHECK_EQUAL(decoded.at(0), CborValue(block));
+
+    // Together with string references and deterministic keys.
+    writer.setStringReferences(true);
+    writer.setDeterministic(true);
+    BOOST_CHECK_EQUAL(decode(writer.write(CborValue(items))), CborValue(items));
+
+    // The items of a repeated item are not marked unless they occur elsewhere.
+    std::vector<CborValue> pair;
+    pair.push_back(CborValue(1));
+    pair.push_back(CborValue(2));
+
+    std::vector<CborValue> outer(1, CborValue(pair));
+    std::vector<CborValue> twice(2, CborValue(outer));
+
+    writer.setStringReferences(false);
+    writer.setDeterministic(false);
+    BOOST_CHECK(writer.write(CborValue(twice)) == toVector("\x82\xd8\x1c\x81\x82\x01\x02\xd8\x1d\x00"));
+
+    // Invalid and cyclic references.
+    BOOST_CHECK(decode(toVector("\xd8\x1d\x00")).isNull());
+    BOOST_CHECK(decode(toVector("\xd8\x1c\x81\xd8\x1d\x00")).isNull());
+    BOOST_CHECK(decode(toVector("\x82\xd8\x1c\x81\x01\xd8\x1d\x01")).isNull());
+}
+
+BOOST_AUTO_TEST_CASE( FrozenDocuments )
+{
+    std::vector<CborValue> route;
+    route.push_back(CborValue("10.0.0.1"));
+    route.push_back(CborValue(443));
+
+    std::map<CborValue, CborValue> routes;
+    routes[CborValue("a")] = CborValue(route);
+    routes[CborValue("b")] = CborValue(std::vector<CborValue>(route));
+
+    CborValue table(routes);
+    CborFrozen::Ptr frozen = CborFrozen::freeze(table);
+
+    BOOST_CHECK_EQUAL(frozen->root(), table);
+    BOOST_CHECK_EQUAL(frozen->root().hash(), table.hash());
+
+    // Equal subtrees are stored once and not shared with the source.
+    const CborValue *a = frozen->root().find("a");
+    const CborValue *b = frozen->root().find("b");
+
+    BOOST_REQUIRE(a != 0 && b != 0);
+    BOOST_CHECK(a->getIf< std::vector<CborValue> >() == b->getIf< std::vector<CborValue> >());
+    BOOST_CHECK(a->getIf< std::vector<CborValue> >() != table.find("a")->getIf< std::vector<CborValue> >());
+
+    CborPath path;
+    path.push_back(CborValue("b"));
+    path.push_back(CborValue(1));
+
+    BOOST_REQUIRE(frozen->find(path) != 0);
+    BOOST_CHECK_EQUAL(frozen->find(path)->toPositiveInteger(), 443u);
+
+    path[1] = CborValue(2);
+    BOOST_CHECK(frozen->find(path) == 0);
+    path[0] = CborValue("c");
+    BOOST_CHECK(frozen->find(path) == 0);
+    BOOST_CHECK(frozen->find(CborPath()) == &frozen->root());
+
+    // Readers see every version whole while a writer publishes new ones.
+    CborSnapshot snapshot;
+    CborSnapshot::Reader idle(snapshot);
+
+    BOOST_CHECK(idle.current() == 0);
+    BOOST_CHECK(snapshot.load() == 0);
+
+    const uint64_t versions = 200;
+    std::atomic<bool> consistent(true);
+    std::vector<std::thread> readers;
+
+    for(int i = 0; i < 4; ++i)
+    {
+        readers.push_back(std::thread([&snapshot, &consistent, versions]() {
+            CborSnapshot::Reader reader(snapshot);
+            uint64_t last = 0;
+
+            while( last < versions )
+            {
+                const CborFrozen *document = reader.current();
+
+                if( document == 0 )
+                    continue;
+
+                uint64_t first = document->root().at(0).toPositiveInteger();
+                uint64_t second = document->find(CborPath(1, CborValue(1)))->toPositiveInteger();
+
+                if( first != second || first < last )
+                    consistent = false;
+
+                last = first;
+            }
+        }));
+    }
+
+    for(uint64_t version = 1; version <= versions; ++version)
+    {
+        std::vector<CborValue> document(2, CborValue(version));
+        snapshot.publish(CborFrozen::freeze(CborValue(document)));
+    }
+
+    for(size_t i = 0; i < readers.size(); ++i)
+        readers[i].join();
+
+    BOOST_CHECK(consistent);
+    BOOST_CHECK_EQUAL(snapshot.version(), versions);
+    BOOST_CHECK_EQUAL(idle.current()->root().at(1).toPositiveInteger(), versions);
+}
+
+BOOST_AUTO_TEST_CASE( ParallelEncoding )
+{
+    std::vector<CborValue> records;
+    std::map<CborValue, CborValue> index;
+
+    for(int i = 0; i < 5000; ++i)
+    {
+        std::map<CborValue, CborValue> record;
+
+        record[CborValue("id")] = CborValue(i);
+        record[CborValue("name")] = CborValue("record " + std::to_string(i));
+        record[CborValue(i % 7 == 0 ? "weight" : "score")] = CborValue(i * 0.5);
+
+        records.push_back(CborValue(record));
+        index[CborValue(std::to_string(i))] = CborValue(i);
+    }
+
+    std::map<CborValue, CborValue> document;
+    document[CborValue("records")] = CborValue(records);
+    document[CborValue("index")] = CborValue(index);
+
+    CborValue value(document);
+    CborWriter serial;
+    CborWriter parallel;
+
+    BOOST_CHECK_EQUAL(parallel.threadsCount(), 1u);
+    parallel.setThreadsCount(4);
+    BOOST_CHECK_EQUAL(parallel.threadsCount(), 4u);
+
+    std::vector<char> expected = serial.write(value);
+
+    BOOST_CHECK(parallel.write(value) == expected);
+    BOOST_CHECK(decode(expected) == value);
+
+    serial.setDeterministic(true);
+    parallel.setDeterministic(true);
+    expected = serial.write(value);
+    BOOST_CHECK(parallel.write(value) == expected);
+    BOOST_CHECK(parallel.write(value) == expected);
+
+    // Appends to the data in the buffer.
+    std::vector<char> buff(1, '\x01');
+    parallel.write(buff, CborValue(records));
+    BOOST_CHECK_EQUAL(buff.size(), serial.write(CborValue(records)).size() + 1);
+
+    parallel.setValueSharing(true);
+    serial.setValueSharing(true);
+    BOOST_CHECK(parallel.write(value) == serial.write(value));
+}
+
+#ifdef __cpp_impl_coroutine
+
+BOOST_AUTO_TEST_CASE( ItemStream )
+{
+    int fds[2];
+
+    BOOST_REQUIRE(pipe(fds) == 0);
+    BOOST_REQUIRE(fcntl(fds[0], F_SETFL, O_NONBLOCK) == 0);
+
+    CborItemStream stream = cborReadStream(fds[0]);
+
+    // Nothing to read yet.
+    BOOST_CHECK(stream.next() == false);
+    BOOST_CHECK(stream.done() == false);
+
+    // Two items and the first half of the third one.
+    std::vector<char> data = toVector("\x01\x82\x61\x61\x02\x83\x01");
+
+    BOOST_REQUIRE(write(fds[1], data.data(), data.size()) == static_cast<ssize_t>(data.size()));
+    BOOST_REQUIRE(stream.next());
+    BOOST_CHECK_EQUAL(stream.value(), CborValue(1));
+    BOOST_REQUIRE(stream.next());
+    BOOST_CHECK_EQUAL(stream.value().at(0), CborValue("a"));
+    BOOST_CHECK(stream.next() == false);
+    BOOST_CHECK(stream.done() == false);
+
+    data = toVector("\x02\x03\xf5");
+    BOOST_REQUIRE(write(fds[1], data.data(), data.size()) == static_cast<ssize_t>(data.size()));
+    BOOST_REQUIRE(stream.next());
+    BOOST_CHECK_EQUAL(stream.value().size(), 3u);
+    BOOST_REQUIRE(stream.next());
+    BOOST_CHECK(stream.value().toBool());
+
+    // A nested item arrives byte by byte; its scan resumes where it stopped.
+    std::vector<char> nested = toVector("\xa2\x61\x61\x82\x01\x82\x02\x62\x62\x63\x61\x64\x41\x00");
+
+    for(size_t i = 0; i + 1 < nested.size(); ++i)
+    {
+        BOOST_REQUIRE(write(fds[1], &nested[i], 1) == 1);
+        BOOST_CHECK(stream.next() == false);
+    }
+
+    BOOST_REQUIRE(write(fds[1], &nested.back(), 1) == 1);
+    BOOST_REQUIRE(stream.next());
+    BOOST_CHECK_EQUAL(stream.value(), cborRead(nested));
+
+    // A large item arrives in several reads.
+    std::vector<char> large = cborWrite(CborValue(std::string(100000, 'x')));
+
+    BOOST_REQUIRE(write(fds[1], large.data(), 1000) == 1000);
+    BOOST_CHECK(stream.next() == false);
+
+    std::thread writer([&]() {
+        size_t written = 1000;
+
+        while( written < large.size() )
+        {
+            ssize_t count = write(fds[1], large.data() + written, large.size() - written);
+
+            if( count > 0 )
+                written += count;
+        }
+
+        close(fds[1]);
+    });
+
+    while( stream.next() == false && stream.done() == false )
+        usleep(1000);
+
+    writer.join();
+
+    BOOST_CHECK_EQUAL(stream.value().toString().size(), 100000u);
+
+    while( stream.next() == false && stream.done() == false )
+        usleep(1000);
+
+    BOOST_CHECK(stream.done());
+    BOOST_CHECK_EQUAL(stream.error(), 0);
+    close(fds[0]);
+
+    // Malformed data and a stream which ends inside an item.
+    const char *inputs[] = {"\x01\x1f", "\x82\x01"};
+    int errors[] = {EPROTO, ECONNRESET};
+
+    for(size_t i = 0; i < 2; ++i)
+    {
+        BOOST_REQUIRE(pipe(fds) == 0);
+        BOOST_REQUIRE(fcntl(fds[0], F_SETFL, O_NONBLOCK) == 0);
+        BOOST_REQUIRE(write(fds[1], inputs[i], 2) == 2);
+        close(fds[1]);
+
+        CborItemStream broken = cborReadStream(fds[0]);
+
+        while( broken.next() )
+            ;
+
+        BOOST_CHECK(broken.done());
+        BOOST_CHECK_EQUAL(broken.error(), errors[i]);
+        close(fds[0]);
+    }
+}
+
+#endif // __cpp_impl_coroutine
+
+BOOST_AUTO_TEST_CASE( DiffAndPatch )
+{
+    std::vector<CborValue> users;
+
+    for(int i = 0; i < 100; ++i)
+    {
+        std::map<CborValue, CborValue> user;
+
+        user[CborValue("id")] = CborValue(i);
+        user[CborValue("name")] = CborValue("user " + std::to_string(i));
+        users.push_back(CborValue(user));
+    }
+
+    std::map<CborValue, CborValue> state;
+    state[CborValue("users")] = CborValue(users);
+    state[CborValue("version")] = CborValue(1);
+    state[CborValue("flags")] = CborValue(std::vector<CborValue>(3, CborValue(true)));
+
+    CborValue from(state);
+
+    // One changed leaf gives one small operation.
+    CborValue to = from;
+    CborValue users2 = to.member("users");
+    CborValue user = users2.at(42);
+
+    user.setMember(CborValue("name"), CborValue("renamed"));
+    users2.setAt(42, user);
+    to.setMember(CborValue("users"), users2);
+
+    CborValue patch = cborDiff(from, to);
+
+    BOOST_REQUIRE_EQUAL(patch.size(), 1u);
+    BOOST_CHECK(cborWrite(patch).size() < 32);
+
+    CborValue patched = from;
+
+    BOOST_REQUIRE(cborPatch(patched, patch));
+    BOOST_CHECK_EQUAL(patched, to);
+    BOOST_CHECK_EQUAL(from.member("users").at(42).member("name").toString(), "user 42");
+
+    // Added and removed members, shorter and longer arrays, new types.
+    to.removeMember(CborValue("version"));
+    to.setMember(CborValue("owner"), CborValue("me"));
+
+    CborValue flags = to.member("flags");
+    flags.resize(1);
+    to.setMember(CborValue("flags"), flags);
+    users2.append(CborValue(100));
+    users2.setAt(0, CborValue("replaced"));
+    to.setMember(CborValue("users"), users2);
+
+    patch = cborDiff(from, to);
+    patched = from;
+    BOOST_REQUIRE(cborPatch(patched, patch));
+    BOOST_CHECK_EQUAL(patched, to);
+
+    // Equal trees built separately give an empty patch, the patch survives
+    // encoding.
+    BOOST_CHECK_EQUAL(cborDiff(from, decode(cborWrite(from))).size(), 0u);
+    patched = from;
+    BOOST_REQUIRE(cborPatch(patched, decode(cborWrite(patch))));
+    BOOST_CHECK_EQUAL(patched, to);
+
+    // An insertion at the front replaces the array.
+    std::vector<CborValue> shifted(1, CborValue(-1));
+    shifted.insert(shifted.end(), users.begin(), users.end());
+    patch = cborDiff(CborValue(users), CborValue(shifted));
+    BOOST_CHECK_EQUAL(patch.size(), 1u);
+
+    // Several edits inside one big item of a short array stay edits.
+    std::vector<CborValue> document;
+    document.push_back(CborValue(users));
+    document.push_back(CborValue("small"));
+
+    CborValue edited(document);
+    CborValue editedUsers = edited.at(0);
+
+    for(int i = 0; i < 100; i += 25)
+    {
+        CborValue item = editedUsers.at(i);
+
+        item.setMember(CborValue("name"), CborValue("edited"));
+        editedUsers.setAt(i, item);
+    }
+
+    edited.setAt(0, editedUsers);
+    patch = cborDiff(CborValue(document), edited);
+    BOOST_CHECK_EQUAL(patch.size(), 4u);
+    BOOST_CHECK(cborWrite(patch).size() < cborWrite(edited).size() / 10);
+
+    patched = CborValue(document);
+    BOOST_REQUIRE(cborPatch(patched, patch));
+    BOOST_CHECK_EQUAL(patched, edited);
+
+    patch = cborDiff(CborValue(std::vector<CborValue>(1, CborValue(users))),
+                     CborValue(std::vector<CborValue>(1, editedUsers)));
+    BOOST_CHECK_EQUAL(patch.size(), 4u);
+
+    patch = cborDiff(CborValue(1), CborValue("one"));
+    patched = CborValue(1);
+    BOOST_REQUIRE(cborPatch(patched, patch));
+    BOOST_CHECK_EQUAL(patched, CborValue("one"));
+
+    // Patches which do not fit leave the value unchanged.
+    CborValue removeMissing = decode(toVector("\x81\x82\x01\x81\x61\x78"));
+    CborValue setDeep = decode(toVector("\x82\x83\x00\x81\x61\x61\x01\x83\x00\x82\x61\x78\x61\x79\x02"));
+    CborValue map = decode(toVector("\xa1\x61\x61\x02"));
+
+    patched = map;
+    BOOST_CHECK(cborPatch(patched, removeMissing) == false);
+    BOOST_CHECK(cborPatch(patched, setDeep) == false);
+    BOOST_CHECK_EQUAL(patched, map);
+    BOOST_CHECK(cborPatch(patched, CborValue(1)) == false);
+}
+
+BOOST_AUTO_TEST_CASE( EncodedEdits )
+{
+    std::map<CborValue, CborValue> settings;
+    std::vector<CborValue> ports;
+
+    ports.push_back(CborValue(80));
+    ports.push_back(CborValue(443));
+    settings[CborValue("ports")] = CborValue(ports);
+    settings[CborValue("name")] = CborValue("server");
+    settings[CborValue(7)] = CborValue(-7);
+    settings[CborValue(std::vector<CborValue>(1, CborValue(1)))] = CborValue("array key");
+
+    CborValue document(settings);
+    std::vector<char> data = cborWrite(document);
+
+    CborPath path;
+    size_t offset = 0;
+    size_t length = 0;
+
+    BOOST_REQUIRE(cborFindItem(data.data(), data.size(), path, offset, length));
+    BOOST_CHECK_EQUAL(offset, 0u);
+    BOOST_CHECK_EQUAL(length, data.size());
+
+    path.push_back(CborValue("ports"));
+    path.push_back(CborValue(1));
+    BOOST_REQUIRE(cborFindItem(data.data(), data.size(), path, offset, length));
+    BOOST_CHECK(std::vector<char>(data.begin() + offset, data.begin() + offset + length) == cborWrite(CborValue(443)));
+
+    // The same size is written in place.
+    size_t size = data.size();
+
+    BOOST_REQUIRE(cborReplaceItem(data, path, CborValue(8443)));
+    BOOST_CHECK_EQUAL(data.size(), size);
+
+    CborValue changedPorts = document.member("ports");
+    changedPorts.setAt(1, CborValue(8443));
+    document.setMember(CborValue("ports"), changedPorts);
+    BOOST_CHECK_EQUAL(decode(data), document);
+
+    // Longer and shorter encodings move the rest of the data.
+    BOOST_REQUIRE(cborReplaceItem(data, CborPath(1, CborValue("name")), CborValue("a much longer name")));
+    document.setMember(CborValue("name"), CborValue("a much longer name"));
+    BOOST_CHECK_EQUAL(decode(data), document);
+
+    BOOST_REQUIRE(cborReplaceItem(data, CborPath(1, CborValue("ports")), CborValue(0)));
+    document.setMember(CborValue("ports"), CborValue(0));
+    BOOST_CHECK_EQUAL(decode(data), document);
+
+    // Integer keys and keys which have to be decoded.
+    BOOST_REQUIRE(cborReplaceItem(data, CborPath(1, CborValue(7)), CborValue(true)));
+    BOOST_REQUIRE(cborReplaceItem(data, CborPath(1, CborValue(std::vector<CborValue>(1, CborValue(1)))), CborValue()));
+    document.setMember(CborValue(7), CborValue(true));
+    document.setMember(CborValue(std::vector<CborValue>(1, CborValue(1))), CborValue());
+    BOOST_CHECK_EQUAL(decode(data), document);
+
+    // Missing items leave the data unchanged.
+    std::vector<char> before = data;
+
+    BOOST_CHECK(cborReplaceItem(data, CborPath(1, CborValue("missing")), CborValue(1)) == false);
+    BOOST_CHECK(cborReplaceItem(data, path, CborValue(1)) == false);
+    BOOST_CHECK(cborReplaceItem(data, CborPath(1, CborValue(-7)), CborValue(1)) == false);
+    BOOST_CHECK(data == before);
+
+    // The last of duplicate keys, as decoded.
+    data = toVector("\xa2\x61\x61\x01\x61\x61\x02");
+    BOOST_REQUIRE(cborReplaceItem(data, CborPath(1, CborValue("a")), CborValue(3)));
+    BOOST_CHECK(data == toVector("\xa2\x61\x61\x01\x61\x61\x03"));
+
+    // Truncated data on the way to the item.
+    data = toVector("\x82\x61");
+    BOOST_CHECK(cborFindItem(data.data(), data.size(), CborPath(1, CborValue(1)), offset, length) == false);
+}
+
+BOOST_AUTO_TEST_CASE( EncodedAppends )
+{
+    std::vector<char> data = cborWrite(CborValue(std::vector<CborValue>()));
+    std::vector<CborValue> expected;
+
+    // The header grows at 24 and 256 items.
+    for(int i = 0; i < 300; ++i)
+    {
+        BOOST_REQUIRE(cborAppendItem(data, CborPath(), CborValue(i)));
+        expected.push_back(CborValue(i));
+
+        if( i == 22 || i == 23 || i == 255 || i == 299 )
+            BOOST_CHECK(data == cborWrite(CborValue(expected)));
+    }
+
+    // Nested containers.
+    std::map<CborValue, CborValue> buckets;
+    buckets[CborValue("a")] = CborValue(std::vector<CborValue>(1, CborValue(1)));
+    buckets[CborValue("b")] = CborValue(std::map<CborValue, CborValue>());
+
+    CborValue document(buckets);
+
+    data = cborWrite(document);
+    BOOST_REQUIRE(cborAppendItem(data, CborPath(1, CborValue("a")), CborValue("two")));
+    BOOST_REQUIRE(cborAppendMember(data, CborPath(1, CborValue("b")), CborValue("k"), CborValue(2.5)));
+    BOOST_REQUIRE(cborAppendMember(data, CborPath(), CborValue("c"), CborValue(true)));
+
+    CborValue a = document.member("a");
+    CborValue b = document.member("b");
+
+    a.append(CborValue("two"));
+    b.setMember(CborValue("k"), CborValue(2.5));
+    document.setMember(CborValue("a"), a);
+    document.setMember(CborValue("b"), b);
+    document.setMember(CborValue("c"), CborValue(true));
+    BOOST_CHECK(data == cborWrite(document));
+
+    // A longer header than necessary is made the shortest.
+    data = toVector("\x98\x01\x01");
+    BOOST_REQUIRE(cborAppendItem(data, CborPath(), CborValue(2)));
+    BOOST_CHECK(data == toVector("\x82\x01\x02"));
+
+    // Not a container of the kind.
+    std::vector<char> before = data;
+
+    BOOST_CHECK(cborAppendMember(data, CborPath(), CborValue(1), CborValue(2)) == false);
+    BOOST_CHECK(cborAppendItem(data, CborPath(1, CborValue(0)), CborValue(2)) == false);
+    BOOST_CHECK(data == before);
+
+    data.clear();
+    BOOST_CHECK(cborAppendItem(data, CborPath(), CborValue(2)) == false);
+}
+
+#if defined(__cpp_nontype_template_args) && __cpp_nontype_template_args >= 201911L
+
+namespace {
+
+struct SchemaPoint
+{
+    int32_t x;
+    int32_t y;
+};
+
+struct SchemaMessage
+{
+    uint64_t id;
+    std::string name;
+    double value;
+    bool enabled;
+    std::vector<char> payload;
+    std::vector<int16_t> tags;
+    SchemaPoint origin;
+    std::vector<SchemaPoint> points;
+    std::vector<bool> flags;
+};
+
+typedef CborSchema<SchemaPoint,
+                   CborField<"x", &SchemaPoint::x>,
+                   CborField<"y", &SchemaPoint::y> > SchemaPointSchema;
+
+typedef CborSchema<SchemaMessage,
+                   CborField<"id", &SchemaMessage::id>,
+                   CborField<"name", &SchemaMessage::name>,
+                   CborField<"value", &SchemaMessage::value>,
+                   CborField<"enabled", &SchemaMessage::enabled>,
+                   CborField<"payload", &SchemaMessage::payload>,
+                   CborField<"tags", &SchemaMessage::tags>,
+                   CborField<"origin", &SchemaMessage::origin, SchemaPointSchema>,
+                   CborField<"points", &SchemaMessage::points, SchemaPointSchema>,
+                   CborField<"flags", &SchemaMessage::flags> > SchemaMessageSchema;
+
+CborValue schemaPoint(int x, int y)
+{
+    std::map<CborValue, CborValue> point;
+
+    point[CborValue("x")] = CborValue(x);
+    point[CborValue("y")] = CborValue(y);
+    return CborValue(point);
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE( SchemaDecoders )
+{
+    std::map<CborValue, CborValue> message;
+    std::vector<CborValue> tags;
+    std::vector<CborValue> points;
+
+    tags.push_back(CborValue(-3));
+    tags.push_back(CborValue(1000));
+    points.push_back(schemaPoint(1, -1));
+    points.push_back(schemaPoint(-100000, 100000));
+
+    message[CborValue("id")] = CborValue(uint64_t(1) << 40);
+    message[CborValue("name")] = CborValue("sensor");
+    message[CborValue("value")] = CborValue(1.5);
+    message[CborValue("enabled")] = CborValue(true);
+    message[CborValue("payload")] = CborValue(toVector("\x01\x02"));
+    message[CborValue("tags")] = CborValue(tags);
+    message[CborValue("origin")] = schemaPoint(3, 4);
+    message[CborValue("points")] = CborValue(points);
+    message[CborValue("flags")] = CborValue::raw(toVector("\x83\xf5\xf4\xf5"));
+    message[CborValue("unknown")] = CborValue(std::vector<CborValue>(2, CborValue("skipped")));
+    message[CborValue(1)] = CborValue("integer key");
+
+    std::vector<char> data = cborWrite(CborValue(message));
+    SchemaMessage result = SchemaMessage();
+
+    BOOST_REQUIRE_EQUAL(SchemaMessageSchema::read(data.data(), data.size(), result), data.size());
+    BOOST_CHECK_EQUAL(result.id, uint64_t(1) << 40);
+    BOOST_CHECK_EQUAL(result.name, "sensor");
+    BOOST_CHECK_EQUAL(result.value, 1.5);
+    BOOST_CHECK(result.enabled);
+    BOOST_CHECK(result.payload == toVector("\x01\x02"));
+    BOOST_REQUIRE_EQUAL(result.tags.size(), 2u);
+    BOOST_CHECK_EQUAL(result.tags[0], -3);
+    BOOST_CHECK_EQUAL(result.tags[1], 1000);
+    BOOST_CHECK_EQUAL(result.origin.x, 3);
+    BOOST_CHECK_EQUAL(result.origin.y, 4);
+    BOOST_REQUIRE_EQUAL(result.points.size(), 2u);
+    BOOST_CHECK_EQUAL(result.points[1].x, -100000);
+    BOOST_CHECK_EQUAL(result.points[1].y, 100000);
+    BOOST_CHECK(result.flags == std::vector<bool>({true, false, true}));
+
+    // Integers are accepted for floating point fields.
+    SchemaMessage partial = SchemaMessage();
+    std::vector<char> integerValue = toVector("\xa1\x65value\x38\x63");
+
+    BOOST_REQUIRE_EQUAL(SchemaMessageSchema::read(integerValue.data(), integerValue.size(), partial), integerValue.size());
+    BOOST_CHECK_EQUAL(partial.value, -100.0);
+    BOOST_CHECK(partial.name.empty());
+
+    // Wrong types, out of range integers and truncated data.
+    message[CborValue("tags")] = CborValue(std::vector<CborValue>(1, CborValue(40000)));
+    data = cborWrite(CborValue(message));
+    BOOST_CHECK_EQUAL(SchemaMessageSchema::read(data.data(), data.size(), result), 0u);
+
+    message[CborValue("tags")] = CborValue(tags);
+    message[CborValue("name")] = CborValue(1);
+    data = cborWrite(CborValue(message));
+    BOOST_CHECK_EQUAL(SchemaMessageSchema::read(data.data(), data.size(), result), 0u);
+
+    message[CborValue("name")] = CborValue("sensor");
+    data = cborWrite(CborValue(message));
+    BOOST_CHECK_EQUAL(SchemaMessageSchema::read(data.data(), data.size() - 1, result), 0u);
+    BOOST_CHECK_EQUAL(SchemaPointSchema::read("\x81\x01", 2, result.origin), 0u);
+}
+
+#endif // __cpp_nontype_template_args
+
+BOOST_AUTO_TEST_CASE( JsonTranscoding )
+{
+    std::vector<CborValue> items;
+
+    items.push_back(CborValue(1));
+    items.push_back(CborValue(-10));
+    items.push_back(CborValue(1.5));
+    items.push_back(CborValue(2.0));
+    items.push_back(CborValue(NAN));
+    items.push_back(CborValue(true));
+    items.push_back(CborValue());
+    items.push_back(CborValue("quote \" backslash \\ tab \t bell \x07 caf\xc3\xa9"));
+    items.push_back(CborValue(toVector("\xfb\xff")));
+
+    BOOST_CHECK_EQUAL(cborToJson(cborWrite(CborValue(items))),
+                      "[1,-10,1.5,2.0,null,true,null,"
+                      "\"quote \\\" backslash \\\\ tab \\t bell \\u0007 caf\xc3\xa9\",\"-_8\"]");
+
+    // Keys which are not strings, expected encodings, tags and specials.
+    BOOST_CHECK_EQUAL(cborToJson(toVector("\xa2\x01\x61x\x61" "a\x80")), "{\"1\":\"x\",\"a\":[]}");
+    BOOST_CHECK_EQUAL(cborToJson(toVector("\xd6\x42\x01\x02")), "\"AQI=\"");
+    BOOST_CHECK_EQUAL(cborToJson(toVector("\xd7\x42\xab\xcd")), "\"ABCD\"");
+    BOOST_CHECK_EQUAL(cborToJson(toVector("\xc1\x1a\x00\x00\x00\x10")), "16");
+    BOOST_CHECK_EQUAL(cborToJson(toVector("\xf7")), "null");
+    BOOST_CHECK_EQUAL(cborToJson(toVector("\x3b\xff\xff\xff\xff\xff\xff\xff\xff")), "-18446744073709551616");
+
+    // Malformed items leave the text unchanged.
+    std::string json = "keep";
+    std::vector<char> reference = toVector("\xd8\x19\x00");
+    std::vector<char> truncated = toVector("\x82\x01");
+
+    BOOST_CHECK_EQUAL(cborToJson(reference.data(), reference.size(), json), 0u);
+    BOOST_CHECK_EQUAL(cborToJson(truncated.data(), truncated.size(), json), 0u);
+    BOOST_CHECK_EQUAL(json, "keep");
+
+    // JSON to CBOR.
+    CborValue value = cborRead(cborFromJson(
+        " {\"name\": \"caf\\u00e9 \\ud83d\\ude00\\n\", \"list\": [0, -1, 18446744073709551615,"
+        " -18446744073709551617, 1.5, 1e2, true, false, null], \"empty\": {}} "));
+
+    BOOST_REQUIRE(value.isMap());
+    BOOST_CHECK_EQUAL(value.find(CborValue("name"))->toString(), "caf\xc3\xa9 \xf0\x9f\x98\x80\n");
+    BOOST_CHECK(value.find(CborValue("empty"))->isMap());
+
+    const CborValue &list = *value.find(CborValue("list"));
+
+    BOOST_REQUIRE_EQUAL(list.size(), 9u);
+    BOOST_CHECK(list.at(0) == CborValue(0));
+    BOOST_CHECK(list.at(1) == CborValue(-1));
+    BOOST_CHECK_EQUAL(list.at(2).toPositiveInteger(), std::numeric_limits<uint64_t>::max());
+    BOOST_CHECK(list.at(3).isDouble());
+    BOOST_CHECK_EQUAL(list.at(4).toDouble(), 1.5);
+    BOOST_CHECK(list.at(5) == CborValue(100.0));
+    BOOST_CHECK(list.at(6) == CborValue(true));
+    BOOST_CHECK(list.at(7) == CborValue(false));
+    BOOST_CHECK(list.at(8).isNull());
+
+    // Members keep their order, text goes back as it was.
+    std::string compact = "{\"b\":[1,-2,1.5,\"x\\\"y\"],\"a\":null}";
+
+    BOOST_CHECK_EQUAL(cborToJson(cborFromJson(compact)), compact);
+
+    // Containers which need a longer header than their first byte.
+    std::string longArray = "[[";
+
+    for(int i = 0; i < 300; ++i)
+        longArray += i == 0 ? "0" : ",0";
+
+    longArray += "],\"tail\"]";
+
+    std::vector<CborValue> expected;
+
+    expected.push_back(CborValue(std::vector<CborValue>(300, CborValue(0))));
+    expected.push_back(CborValue("tail"));
+    BOOST_CHECK(cborFromJson(longArray) == cborWrite(CborValue(expected)));
+
+    // Malformed text leaves the data unchanged.
+    const char *malformed[] = {"", "[1,]", "{\"a\" 1}", "\"\\ud800\"", "\"tab\there\"",
+                               "01", "1 2", "-", "[1", "tru", "\"\\x\""};
+    std::vector<char> data = toVector("\x01");
+
+    for(size_t i = 0; i < sizeof(malformed) / sizeof(malformed[0]); ++i)
+        BOOST_CHECK_MESSAGE(!cborFromJson(malformed[i], strlen(malformed[i]), data), malformed[i]);
+
+    BOOST_CHECK(data == toVector("\x01"));
+    BOOST_CHECK(cborFromJson(std::string(600, '[') + std::string(600, ']')).empty());
+}
+
+BOOST_AUTO_TEST_CASE( DiagnosticNotation )
+{
+    std::map<CborValue, CborValue> members;
+    std::vector<CborValue> items;
+
+    items.push_back(CborValue(1));
+    items.push_back(CborValue(-2));
+    items.push_back(CborValue(1.0));
+    items.push_back(CborValue(NAN));
+    items.push_back(CborValue(-INFINITY));
+    items.push_back(CborValue(CborValue::UndefinedTag()));
+    items.push_back(CborValue(toVector("\x01\xff")));
+    items.push_back(CborValue("a \"b\"\n"));
+
+    members[CborValue("list")] = CborValue(items);
+    members[CborValue(false)] = CborValue();
+
+    CborValue value(members);
+
+    BOOST_CHECK_EQUAL(value.inspect(),
+                      "{false: null, \"list\": [1, -2, 1.0, NaN, -Infinity, undefined, h'01ff', \"a \\\"b\\\"\\n\"]}");
+    BOOST_CHECK_EQUAL(CborValue(uint64_t(0), false).inspect(), "-18446744073709551616");
+    BOOST_CHECK_EQUAL(decode(toVector("\xc2\x42\x01\x00")).inspect(), "2(h'0100')");
+    BOOST_CHECK_EQUAL(decode(toVector("\xc4\x82\x21\x19\x6a\xb3")).inspect(), "4([-2, 27315])");
+    BOOST_CHECK_EQUAL(decode(toVector("\xc1\x1a\x51\x4b\x67\xb0")).inspect(), "1(1363896240)");
+
+    // Depth and length limits; the string overload appends.
+    std::string text = "value: ";
+
+    value.writeDiagnostic(text, 1);
+    BOOST_CHECK_EQUAL(text, "value: {false: null, \"list\": [...]}");
+
+    text.clear();
+    value.writeDiagnostic(text, CborValue::noLimit, 20);
+    BOOST_CHECK_EQUAL(text, "{false: null, \"list\"...");
+
+    // A long document goes to the stream in chunks and is cut the same way.
+    std::vector<CborValue> many(10000, CborValue("item"));
+    std::ostringstream stream;
+    std::string expected;
+
+    CborValue(many).writeDiagnostic(stream);
+    CborValue(many).writeDiagnostic(expected);
+    BOOST_CHECK(stream.str() == expected);
+    BOOST_CHECK_EQUAL(expected.size(), 10000u * 8);
+
+    stream.str("");
+    CborValue(many).writeDiagnostic(stream, CborValue::noLimit, 5000);
+    BOOST_CHECK(stream.str() == expected.substr(0, 5000) + "...");
+}
+
+BOOST_AUTO_TEST_CASE( DecodeStatsAndMemoryUsage )
+{
+    std::map<CborValue, CborValue> members;
+    std::vector<CborValue> items;
+
+    items.push_back(CborValue("a string longer than the inline buffer"));
+    items.push_back(CborValue(1));
+    items.push_back(CborValue(toVector("\x01\x02\x03")));
+    members[CborValue("items")] = CborValue(items);
+    members[CborValue("flag")] = CborValue(true);
+
+    std::vector<char> data = cborWrite(CborValue(members));
+    CborDecoder decoder;
+    CborValue value;
+
+    decoder.setCollectingStats(true);
+    BOOST_REQUIRE(decoder.read(data.data(), data.size(), value));
+
+    const CborDecodeStats &stats = decoder.lastStats();
+
+    BOOST_CHECK_EQUAL(stats.nodes[CborValue::MapType], 1u);
+    BOOST_CHECK_EQUAL(stats.nodes[CborValue::ArrayType], 1u);
+    BOOST_CHECK_EQUAL(stats.nodes[CborValue::StringType], 3u);
+    BOOST_CHECK_EQUAL(stats.nodes[CborValue::ByteStringType], 1u);
+    BOOST_CHECK_EQUAL(stats.nodes[CborValue::PositiveIntegerType], 1u);
+    BOOST_CHECK_EQUAL(stats.nodes[CborValue::BoolType], 1u);
+    BOOST_CHECK_EQUAL(stats.maxDepth, 2u);
+    BOOST_CHECK_EQUAL(stats.stringBytes, 5u + 4u + 38u + 3u);
+
+    // A fresh decoder allocates all the result holds.
+    BOOST_CHECK(stats.allocations > 0);
+    BOOST_CHECK_EQUAL(stats.heapBytes, value.memoryUsage());
+
+    // The empty containers all results share are counted by neither.
+    CborDecoder emptyDecoder;
+    CborValue empties;
+    std::vector<char> emptyData = toVector("\x83\x80\xa0\x01");
+
+    emptyDecoder.setCollectingStats(true);
+    BOOST_REQUIRE(emptyDecoder.read(emptyData.data(), emptyData.size(), empties));
+    BOOST_CHECK_EQUAL(emptyDecoder.lastStats().heapBytes, empties.memoryUsage());
+    BOOST_CHECK_EQUAL(empties.at(0).memoryUsage(), 0u);
+    BOOST_CHECK_EQUAL(empties.at(1).memoryUsage(), 0u);
+
+    // With recycled storage the same message allocates nothing.
+    decoder.recycle(value);
+    BOOST_REQUIRE(decoder.read(data.data(), data.size(), value));
+    BOOST_CHECK_EQUAL(decoder.lastStats().allocations, 0u);
+    BOOST_CHECK_EQUAL(decoder.lastStats().heapBytes, 0u);
+    BOOST_CHECK_EQUAL(decoder.lastStats().nodes[CborValue::StringType], 3u);
+
+    // Shared payloads are counted once.
+    CborValue array(items);
+    CborValue twice(std::vector<CborValue>(2, array));
+    CborValue scalars(std::vector<CborValue>(2, CborValue(1)));
+
+    BOOST_CHECK_EQUAL(twice.memoryUsage(), scalars.memoryUsage() + array.memoryUsage());
+
+    // Every map member takes a node.
+    CborValue map = CborValue(std::map<CborValue, CborValue>());
+    std::vector<size_t> usage;
+
+    for(int i = 0; i < 3; ++i)
+    {
+        usage.push_back(map.memoryUsage());
+        map.setMember(CborValue(i), CborValue(i));
+    }
+
+    BOOST_CHECK(usage[1] - usage[0] == usage[2] - usage[1]);
+    BOOST_CHECK(usage[1] - usage[0] > 2 * sizeof(CborValue));
+    BOOST_CHECK_EQUAL(CborValue(1).memoryUsage(), 0u);
+}